@@ -0,0 +1,284 @@
+//
+//  dns_benchmark.cpp
+//  simple_proxy
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../simple_proxy/event_queue.hpp"
+#include "../simple_proxy/dns_resolver.hpp"
+#include "../simple_proxy/dns_cache.hpp"
+
+/*
+ stress of resolvers working in several event loops at once with one shared cache,
+ like proxy does with --workers. Local responder answers "h<N>.bench":
+ every 17th name doesn't exist, every 13th answer is truncated and repeated over TCP.
+ Every lookup is checked, exit code isn't zero if something went wrong
+ */
+
+namespace {
+    const size_t NAMES = 4096;
+    // lookups in flight per event loop
+    const size_t WINDOW = 64;
+
+    std::string name_of(size_t number) {
+        return "h" + std::to_string(number) + ".bench";
+    }
+
+    std::string address_of(size_t number) {
+        return "10." + std::to_string((number >> 16) & 0xFF) + "." + std::to_string((number >> 8) & 0xFF) + "." + std::to_string(number & 0xFF);
+    }
+
+    bool is_missing(size_t number) {
+        return number % 17 == 0;
+    }
+
+    bool is_truncated(size_t number) {
+        return number % 13 == 0;
+    }
+
+    uint16_t read16(std::string const& data, size_t pos) {
+        return static_cast<uint16_t>((static_cast<unsigned char>(data[pos]) << 8) | static_cast<unsigned char>(data[pos + 1]));
+    }
+
+    void write16(std::string& out, uint16_t value) {
+        out.push_back(static_cast<char>(value >> 8));
+        out.push_back(static_cast<char>(value));
+    }
+
+    /*
+     answer to query with one question, empty if query is malformed.
+     Number of name is taken from it's first label
+     */
+    std::string answer(std::string const& query, bool over_tcp) {
+        static const size_t HEADER_SIZE = 12;
+        size_t pos = HEADER_SIZE;
+        while (pos < query.size() && query[pos] != 0) {
+            pos += static_cast<unsigned char>(query[pos]) + 1;
+        }
+        if (pos + 5 > query.size() || query.size() <= HEADER_SIZE + 2) {
+            return std::string();
+        }
+        size_t question_end = pos + 5;
+        uint16_t type = read16(query, pos + 1);
+        size_t number = strtoul(query.c_str() + HEADER_SIZE + 2, nullptr, 10);
+
+        bool missing = is_missing(number);
+        bool truncated = !missing && !over_tcp && is_truncated(number);
+        bool has_answer = !missing && !truncated && type == 1;
+
+        std::string out;
+        write16(out, read16(query, 0));
+        write16(out, missing ? 0x8183 : (truncated ? 0x8380 : 0x8180));
+        write16(out, 1);
+        write16(out, has_answer ? 1 : 0);
+        write16(out, 0);
+        write16(out, 0);
+        out.append(query, HEADER_SIZE, question_end - HEADER_SIZE);
+        if (has_answer) {
+            //name is pointer to the question
+            write16(out, 0xC00C);
+            write16(out, 1);
+            write16(out, 1);
+            write16(out, 0);
+            write16(out, 60);
+            write16(out, 4);
+            in_addr address;
+            inet_pton(AF_INET, address_of(number).c_str(), &address);
+            out.append(reinterpret_cast<const char*>(&address), 4);
+        }
+        return out;
+    }
+
+    // UDP and TCP nameserver on localhost, until stop is set
+    struct responder {
+        responder() {
+            //port is chosen for UDP, it could be busy for TCP, then another one is tried
+            for (int attempt = 0; attempt < 100 && !open_sockets(); attempt++) {
+                close(udp);
+                close(tcp);
+            }
+            if (port == 0) {
+                perror("bind");
+                exit(1);
+            }
+            worker = std::thread([this]() { serve(); });
+        }
+
+        ~responder() {
+            stop = true;
+            worker.join();
+            close(udp);
+            close(tcp);
+        }
+
+        uint16_t port = 0;
+        std::atomic<size_t> udp_queries{0};
+        std::atomic<size_t> tcp_queries{0};
+    private:
+        int udp = -1;
+        int tcp = -1;
+        std::atomic<bool> stop{false};
+        std::thread worker;
+
+        bool open_sockets() {
+            udp = socket(AF_INET, SOCK_DGRAM, 0);
+            tcp = socket(AF_INET, SOCK_STREAM, 0);
+            //queries of all loops come at once, lost ones would wait for resolver timeout
+            int buffer_size = 4 << 20;
+            setsockopt(udp, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+            int set = 1;
+            setsockopt(tcp, SOL_SOCKET, SO_REUSEADDR, &set, sizeof(set));
+
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t size = sizeof(address);
+            if (bind(udp, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1
+                || getsockname(udp, reinterpret_cast<sockaddr*>(&address), &size) == -1
+                || bind(tcp, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1
+                || listen(tcp, SOMAXCONN) == -1) {
+                return false;
+            }
+            port = ntohs(address.sin_port);
+            return true;
+        }
+
+        void serve() {
+            pollfd sockets[2] = {{udp, POLLIN, 0}, {tcp, POLLIN, 0}};
+            char data[512];
+            while (!stop) {
+                if (poll(sockets, 2, 50) <= 0) {
+                    continue;
+                }
+                while (sockets[0].revents & POLLIN) {
+                    sockaddr_in from;
+                    socklen_t size = sizeof(from);
+                    ssize_t len = recvfrom(udp, data, sizeof(data), MSG_DONTWAIT, reinterpret_cast<sockaddr*>(&from), &size);
+                    if (len <= 0) {
+                        break;
+                    }
+                    udp_queries++;
+                    std::string reply = answer(std::string(data, static_cast<size_t>(len)), false);
+                    sendto(udp, reply.data(), reply.size(), 0, reinterpret_cast<sockaddr*>(&from), size);
+                }
+                if (sockets[1].revents & POLLIN) {
+                    serve_tcp(accept(tcp, nullptr, nullptr));
+                }
+            }
+        }
+
+        // resolver sends one query per connection, it's small enough to come at once
+        void serve_tcp(int client) {
+            if (client == -1) {
+                return;
+            }
+            std::string query;
+            char data[512];
+            while (query.size() < 2 || query.size() < read16(query, 0) + 2u) {
+                ssize_t len = recv(client, data, sizeof(data), 0);
+                if (len <= 0) {
+                    close(client);
+                    return;
+                }
+                query.append(data, static_cast<size_t>(len));
+            }
+            tcp_queries++;
+            std::string reply = answer(query.substr(2), true);
+            std::string framed;
+            write16(framed, static_cast<uint16_t>(reply.size()));
+            framed += reply;
+            send(client, framed.data(), framed.size(), MSG_NOSIGNAL);
+            close(client);
+        }
+    };
+
+    struct counters {
+        std::atomic<size_t> cached{0};
+        std::atomic<size_t> resolved{0};
+        std::atomic<size_t> wrong{0};
+    };
+
+    bool check(size_t number, dns_resolver::result const& result) {
+        if (is_missing(number)) {
+            return result.status == dns_resolver::Status::NOT_FOUND && result.addresses.empty();
+        }
+        return result.status == dns_resolver::Status::OK
+               && result.addresses.size() == 1 && result.addresses[0] == address_of(number);
+    }
+
+    // one event loop, like one worker of proxy
+    void run_loop(dns_cache* cache, uint16_t port, size_t lookups, uint32_t seed, counters& total) {
+        event_queue queue;
+        dns_resolver resolver(&queue, cache);
+        resolver.set_nameserver("127.0.0.1", port);
+
+        size_t started = 0;
+        size_t finished = 0;
+        while (finished < lookups) {
+            while (started < lookups && started - finished < WINDOW) {
+                seed = seed * 1103515245 + 12345;
+                size_t number = (seed >> 8) % NAMES;
+                started++;
+
+                dns_resolver::result cached;
+                if (resolver.resolve_cached(name_of(number), cached)) {
+                    total.cached++;
+                    total.wrong += !check(number, cached);
+                    finished++;
+                    continue;
+                }
+                //same names in flight share one lookup, every callback is still called once
+                resolver.resolve(name_of(number), [number, &finished, &total](dns_resolver::result const& result) {
+                    total.resolved++;
+                    total.wrong += !check(number, result);
+                    finished++;
+                });
+            }
+            queue.execute(queue.occurred());
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t threads = argc > 1 ? strtoul(argv[1], nullptr, 10) : 4;
+    size_t lookups = argc > 2 ? strtoul(argv[2], nullptr, 10) : 20000;
+    if (threads == 0 || lookups == 0) {
+        fprintf(stderr, "usage: dns_benchmark [THREADS] [LOOKUPS PER THREAD]\n");
+        return 1;
+    }
+
+    responder server;
+    //smaller than set of names, so entries are evicted while other threads read them
+    dns_cache cache(NAMES / 4);
+    counters total;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> loops;
+    for (size_t i = 0; i < threads; i++) {
+        loops.emplace_back(run_loop, &cache, server.port, lookups, static_cast<uint32_t>(i + 1), std::ref(total));
+    }
+    for (std::thread& loop: loops) {
+        loop.join();
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    size_t all = total.cached + total.resolved;
+    printf("%zu loops, %zu lookups in %lld ms, %.0f lookups/s\n", threads, all,
+           static_cast<long long>(elapsed.count()), all * 1000.0 / std::max<long long>(elapsed.count(), 1));
+    printf("from cache %zu, by network %zu, queries over UDP %zu, over TCP %zu\n",
+           total.cached.load(), total.resolved.load(), server.udp_queries.load(), server.tcp_queries.load());
+    printf("wrong answers %zu\n", total.wrong.load());
+    return (total.wrong == 0 && all == threads * lookups) ? 0 : 1;
+}
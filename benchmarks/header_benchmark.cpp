@@ -0,0 +1,90 @@
+//
+//  header_benchmark.cpp
+//  simple_proxy
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "../simple_proxy/http_header.hpp"
+#include "corpus.hpp"
+
+/*
+ cost of parsing one header, as proxy does it:
+ header is appended (whole or by pieces, like it comes from socket)
+ and fields proxy needs are looked up
+ */
+
+namespace {
+    // what proxy asks from the header after it's parsed
+    size_t use(http_header const& header, bool request) {
+        size_t result = header.get_content_length() + static_cast<size_t>(header.get_type());
+        result += header.is_keep_alive();
+        if (request) {
+            result += header.get_url().size() + header.retrieve_port();
+        } else {
+            result += static_cast<size_t>(header.get_status()) + header.get_field(http_header::Field::ETAG).size();
+        }
+        return result;
+    }
+
+    // returns nanoseconds per header
+    double measure(std::vector<std::string> const& messages, bool request, size_t piece, size_t iterations, size_t& sink) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            std::string const& message = messages[i % messages.size()];
+            http_header header;
+            for (size_t pos = 0; pos < message.size(); pos += piece) {
+                header.append(message.data() + pos, std::min(piece, message.size() - pos));
+            }
+            if (header.get_state() != http_header::State::COMPLETE) {
+                fprintf(stderr, "header isn't complete\n");
+                exit(1);
+            }
+            sink += use(header, request);
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        return static_cast<double>(elapsed.count()) / iterations;
+    }
+
+    void report(const char* name, std::vector<std::string> const& messages, bool request, size_t iterations, size_t& sink) {
+        size_t bytes = 0;
+        for (std::string const& message: messages) {
+            bytes += message.size();
+        }
+        double average = static_cast<double>(bytes) / messages.size();
+
+        const size_t pieces[] = {std::string::npos, 512, 64, 8};
+        for (size_t piece: pieces) {
+            double ns = measure(messages, request, piece, iterations, sink);
+            if (piece == std::string::npos) {
+                printf("%-10s whole     %8.1f ns/header %8.1f MB/s\n", name, ns, average * 1000 / ns);
+            } else {
+                printf("%-10s by %-4zu   %8.1f ns/header %8.1f MB/s\n", name, piece, ns, average * 1000 / ns);
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 300000;
+    if (iterations == 0) {
+        fprintf(stderr, "usage: header_benchmark [ITERATIONS]\n");
+        return 1;
+    }
+
+    std::vector<std::string> requests = corpus::requests();
+    std::vector<std::string> responces = corpus::responces();
+
+    size_t sink = 0;
+    //warm up allocator and caches
+    measure(requests, true, std::string::npos, iterations / 10 + 1, sink);
+
+    report("requests", requests, true, iterations, sink);
+    report("responces", responces, false, iterations, sink);
+
+    //keeps results alive
+    return sink == 0 ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+//
+//  scan_benchmark.cpp
+//  simple_proxy
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <functional>
+#include "../simple_proxy/byte_scan.hpp"
+#include "../simple_proxy/http_header.hpp"
+#include "../simple_proxy/chunk_decoder.hpp"
+#include "corpus.hpp"
+
+/*
+ scalar scan against SIMD ones on headers and chunked bodies.
+ Every implementation CPU supports does the same work, both bare scanning
+ (searches like the parsers do) and the parsers themselves
+ */
+
+namespace {
+    // megabytes per second
+    double measure(size_t bytes, size_t iterations, std::function<size_t()> const& work, size_t& sink) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            sink += work();
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        return static_cast<double>(bytes) * iterations * 1000 / elapsed.count();
+    }
+
+    // searches of http_header: name ends with colon, value with line feed
+    size_t scan_lines(std::vector<std::string> const& messages) {
+        size_t found = 0;
+        for (std::string const& message: messages) {
+            const char* end = message.data() + message.size();
+            const char* pos = scan_for(message.data(), end, ' ', '\n');
+            while (pos != end) {
+                pos = scan_for(pos + 1, end, ':', '\n');
+                if (pos != end && *pos == ':') {
+                    pos = scan_for(pos + 1, end, '\n');
+                }
+                found++;
+            }
+        }
+        return found;
+    }
+
+    size_t parse_headers(std::vector<std::string> const& messages) {
+        size_t fields = 0;
+        for (std::string const& message: messages) {
+            http_header header(message);
+            fields += header.get_content_length() + static_cast<size_t>(header.get_type());
+        }
+        return fields;
+    }
+
+    // every line of chunked body, lines of text are long ones
+    size_t scan_chunk_lines(std::string const& body) {
+        size_t lines = 0;
+        const char* end = body.data() + body.size();
+        for (const char* pos = body.data(); pos != end; pos++) {
+            pos = scan_for(pos, end, '\n');
+            if (pos == end) {
+                break;
+            }
+            lines++;
+        }
+        return lines;
+    }
+
+    // body comes by pieces of socket read size
+    size_t decode_chunks(std::string const& body) {
+        static const size_t READ_SIZE = 16384;
+        chunk_decoder decoder;
+        size_t consumed = 0;
+        while (consumed < body.size() && !decoder.is_done() && !decoder.is_failed()) {
+            consumed += decoder.feed(body.data() + consumed, std::min(READ_SIZE, body.size() - consumed));
+        }
+        if (!decoder.is_done()) {
+            fprintf(stderr, "chunked body isn't decoded\n");
+            exit(1);
+        }
+        return consumed;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 20000;
+    if (iterations == 0) {
+        fprintf(stderr, "usage: scan_benchmark [ITERATIONS]\n");
+        return 1;
+    }
+
+    std::vector<std::string> headers = corpus::requests();
+    for (std::string const& responce: corpus::responces()) {
+        headers.push_back(responce);
+    }
+    size_t header_bytes = 0;
+    for (std::string const& header: headers) {
+        header_bytes += header.size();
+    }
+    std::string body = corpus::chunked_body(1 << 20);
+
+    printf("chosen implementation: %s\n", scan_implementation());
+    printf("%-8s %14s %14s %14s %14s (MB/s)\n", "", "header scan", "header parse", "chunk scan", "chunk decode");
+
+    size_t sink = 0;
+    const char* const implementations[] = {"scalar", "sse2", "avx2"};
+    for (const char* name: implementations) {
+        if (!use_scan_implementation(name)) {
+            printf("%-8s not supported\n", name);
+            continue;
+        }
+        //the first run warms up caches
+        measure(header_bytes, iterations / 10 + 1, [&headers]() { return scan_lines(headers); }, sink);
+
+        double header_scan = measure(header_bytes, iterations, [&headers]() { return scan_lines(headers); }, sink);
+        double header_parse = measure(header_bytes, iterations, [&headers]() { return parse_headers(headers); }, sink);
+        //body is much bigger than all headers
+        size_t body_iterations = iterations / 200 + 1;
+        double chunk_scan = measure(body.size(), body_iterations, [&body]() { return scan_chunk_lines(body); }, sink);
+        double chunk_decode = measure(body.size(), body_iterations, [&body]() { return decode_chunks(body); }, sink);
+        printf("%-8s %14.1f %14.1f %14.1f %14.1f\n", name, header_scan, header_parse, chunk_scan, chunk_decode);
+    }
+    use_scan_implementation("auto");
+
+    //keeps results alive
+    return sink == 0 ? 1 : 0;
+}
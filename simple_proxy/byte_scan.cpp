@@ -0,0 +1,117 @@
+//
+//  byte_scan.cpp
+//  simple_proxy
+//
+
+#include "byte_scan.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define BYTE_SCAN_X86
+#include <immintrin.h>
+#endif
+
+typedef const char* (*scanner)(const char*, const char*, char, char, char);
+
+static const char* scan_scalar(const char* begin, const char* end, char a, char b, char c) {
+    for (; begin != end; begin++) {
+        if (*begin == a || *begin == b || *begin == c) {
+            return begin;
+        }
+    }
+    return end;
+}
+
+#ifdef BYTE_SCAN_X86
+__attribute__((target("sse2")))
+static const char* scan_sse2(const char* begin, const char* end, char a, char b, char c) {
+    const __m128i first = _mm_set1_epi8(a);
+    const __m128i second = _mm_set1_epi8(b);
+    const __m128i third = _mm_set1_epi8(c);
+    while (end - begin >= 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        __m128i found = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, first), _mm_cmpeq_epi8(block, second)),
+                                     _mm_cmpeq_epi8(block, third));
+        int mask = _mm_movemask_epi8(found);
+        if (mask != 0) {
+            return begin + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+        begin += 16;
+    }
+    return scan_scalar(begin, end, a, b, c);
+}
+
+__attribute__((target("avx2")))
+static const char* scan_avx2(const char* begin, const char* end, char a, char b, char c) {
+    const __m256i first = _mm256_set1_epi8(a);
+    const __m256i second = _mm256_set1_epi8(b);
+    const __m256i third = _mm256_set1_epi8(c);
+    while (end - begin >= 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        __m256i found = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, first), _mm256_cmpeq_epi8(block, second)),
+                                        _mm256_cmpeq_epi8(block, third));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(found));
+        if (mask != 0) {
+            return begin + __builtin_ctz(mask);
+        }
+        begin += 32;
+    }
+    //tail is shorter than 32 bytes
+    return scan_sse2(begin, end, a, b, c);
+}
+#endif
+
+static scanner select_scanner(const char*& name) {
+#ifdef BYTE_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        name = "avx2";
+        return scan_avx2;
+    }
+    name = "sse2";
+    return scan_sse2;
+#else
+    name = "scalar";
+    return scan_scalar;
+#endif
+}
+
+static const char* implementation = nullptr;
+static scanner current = select_scanner(implementation);
+
+const char* scan_for(const char* begin, const char* end, char a) {
+    return current(begin, end, a, a, a);
+}
+
+const char* scan_for(const char* begin, const char* end, char a, char b) {
+    return current(begin, end, a, b, b);
+}
+
+const char* scan_for(const char* begin, const char* end, char a, char b, char c) {
+    return current(begin, end, a, b, c);
+}
+
+const char* scan_implementation() {
+    return implementation;
+}
+
+bool use_scan_implementation(const char* name) {
+    if (strcmp(name, "auto") == 0) {
+        current = select_scanner(implementation);
+    } else if (strcmp(name, "scalar") == 0) {
+        current = scan_scalar;
+        implementation = "scalar";
+#ifdef BYTE_SCAN_X86
+    } else if (strcmp(name, "sse2") == 0) {
+        current = scan_sse2;
+        implementation = "sse2";
+    } else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        current = scan_avx2;
+        implementation = "avx2";
+#endif
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,31 @@
+//
+//  byte_scan.hpp
+//  simple_proxy
+//
+
+#ifndef byte_scan_hpp
+#define byte_scan_hpp
+
+#include <stdio.h>
+
+/*
+ search of delimiters (CR, LF, colon, ...) in parsed data.
+ Blocks of 32 or 16 bytes are compared at once with AVX2 or SSE2,
+ implementation is chosen on start by features of CPU, plain loop is used elsewhere
+ */
+
+// returns position of the first byte equal to one of given in [begin, end), end if there is no such byte
+const char* scan_for(const char* begin, const char* end, char a);
+const char* scan_for(const char* begin, const char* end, char a, char b);
+const char* scan_for(const char* begin, const char* end, char a, char b, char c);
+
+// name of chosen implementation
+const char* scan_implementation();
+
+/*
+ forces implementation by name: scalar, sse2, avx2 or auto (chosen by CPU).
+ Returns false if it's unknown or unsupported. Isn't thread-safe, it's for benchmarks
+ */
+bool use_scan_implementation(const char* name);
+
+#endif /* byte_scan_hpp */
@@ -0,0 +1,129 @@
+//
+//  chunk_decoder.cpp
+//  simple_proxy
+//
+
+#include "chunk_decoder.hpp"
+#include "byte_scan.hpp"
+
+#include <algorithm>
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+void chunk_decoder::finish_size_line() {
+    if (!has_digits) {
+        state = State::FAILED;
+    } else if (remaining == 0) {
+        //last chunk, trailers follow
+        state = State::TRAILER_START;
+    } else {
+        state = State::DATA;
+    }
+}
+
+size_t chunk_decoder::feed(const char* data, size_t size, std::string* body) {
+    size_t pos = 0;
+    while (pos < size && state != State::DONE && state != State::FAILED) {
+        char c = data[pos];
+        switch (state) {
+            case State::SIZE: {
+                int digit = hex_value(c);
+                if (digit != -1) {
+                    if (remaining > (UINT64_MAX >> 4)) {
+                        state = State::FAILED;
+                        continue;
+                    }
+                    remaining = remaining * 16 + digit;
+                    has_digits = true;
+                } else if (c == ';' || c == ' ' || c == '\t') {
+                    state = State::EXTENSION;
+                } else if (c == '\r') {
+                    state = State::SIZE_LF;
+                } else if (c == '\n') {
+                    finish_size_line();
+                } else {
+                    state = State::FAILED;
+                    continue;
+                }
+                pos++;
+                break;
+            }
+            case State::EXTENSION:
+                //extensions are ignored
+                pos = scan_for(data + pos, data + size, '\n') - data;
+                if (pos < size) {
+                    finish_size_line();
+                    pos++;
+                }
+                break;
+            case State::SIZE_LF:
+                if (c != '\n') {
+                    state = State::FAILED;
+                    continue;
+                }
+                finish_size_line();
+                pos++;
+                break;
+            case State::DATA: {
+                size_t part = static_cast<size_t>(std::min<uint64_t>(remaining, size - pos));
+                if (body) {
+                    body->append(data + pos, part);
+                }
+                remaining -= part;
+                pos += part;
+                if (remaining == 0) {
+                    state = State::DATA_CR;
+                }
+                break;
+            }
+            case State::DATA_CR:
+            case State::DATA_LF:
+                if (c == '\r' && state == State::DATA_CR) {
+                    state = State::DATA_LF;
+                } else if (c == '\n') {
+                    state = State::SIZE;
+                    has_digits = false;
+                } else {
+                    state = State::FAILED;
+                    continue;
+                }
+                pos++;
+                break;
+            case State::TRAILER_START:
+                if (c == '\r') {
+                    state = State::END_LF;
+                } else if (c == '\n') {
+                    state = State::DONE;
+                } else {
+                    state = State::TRAILER;
+                }
+                pos++;
+                break;
+            case State::TRAILER:
+                //trailer fields are passed as is
+                pos = scan_for(data + pos, data + size, '\n') - data;
+                if (pos < size) {
+                    state = State::TRAILER_START;
+                    pos++;
+                }
+                break;
+            case State::END_LF:
+                if (c != '\n') {
+                    state = State::FAILED;
+                    continue;
+                }
+                state = State::DONE;
+                pos++;
+                break;
+            case State::DONE:
+            case State::FAILED:
+                break;
+        }
+    }
+    return pos;
+}
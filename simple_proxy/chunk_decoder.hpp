@@ -0,0 +1,50 @@
+//
+//  chunk_decoder.hpp
+//  simple_proxy
+//
+
+#ifndef chunk_decoder_hpp
+#define chunk_decoder_hpp
+
+#include <stdio.h>
+#include <cstdint>
+#include <string>
+
+/*
+ incremental parser of chunked transfer coding: chunk sizes, extensions and trailers.
+ Body could come in pieces of any size, chunk data isn't copied unless it's asked for
+ */
+struct chunk_decoder {
+    /*
+     consumes bytes of chunked body and stops right after the last byte of message.
+     Returns number of consumed bytes, chunk data is appended to body if it isn't nullptr
+     */
+    size_t feed(const char* data, size_t size, std::string* body = nullptr);
+
+    // the whole message is consumed
+    bool is_done() const {
+        return state == State::DONE;
+    }
+
+    // malformed body, nothing more is consumed
+    bool is_failed() const {
+        return state == State::FAILED;
+    }
+
+    void clear() {
+        state = State::SIZE;
+        remaining = 0;
+        has_digits = false;
+    }
+private:
+    enum class State {SIZE, EXTENSION, SIZE_LF, DATA, DATA_CR, DATA_LF, TRAILER_START, TRAILER, END_LF, DONE, FAILED};
+
+    State state = State::SIZE;
+    // bytes left in current chunk
+    uint64_t remaining = 0;
+    bool has_digits = false;
+
+    void finish_size_line();
+};
+
+#endif /* chunk_decoder_hpp */
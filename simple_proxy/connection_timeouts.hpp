@@ -0,0 +1,24 @@
+//
+//  connection_timeouts.hpp
+//  simple_proxy
+//
+
+#ifndef connection_timeouts_hpp
+#define connection_timeouts_hpp
+
+/*
+ deadlines of client connection, milliseconds.
+ Connection is closed when any of them expires
+ */
+struct connection_timeouts {
+    // nothing was read or written
+    int idle = 600 * 1000;
+    // request header isn't complete since it's first bytes came
+    int header = 30 * 1000;
+    // server isn't connected since request was read, resolving included
+    int connect = 30 * 1000;
+    // server doesn't answer since request was sent
+    int responce = 60 * 1000;
+};
+
+#endif /* connection_timeouts_hpp */
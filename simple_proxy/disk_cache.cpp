@@ -0,0 +1,308 @@
+//
+//  disk_cache.cpp
+//  simple_proxy
+//
+
+#include "disk_cache.hpp"
+#include "custom_exception.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+const uint32_t disk_cache::MAGIC = 0x53504432; // "SPD2"
+const size_t disk_cache::RECORD_HEADER_SIZE = 20;
+const uint64_t disk_cache::MIN_SEGMENT_SIZE = 1 << 20;
+const uint64_t disk_cache::MAX_SEGMENT_SIZE = 256 << 20;
+
+static const std::string SEGMENT_PREFIX{"segment."};
+static const uint32_t MAX_KEY_SIZE = 1 << 16;
+static const uint32_t MAX_ETAG_SIZE = 1 << 10;
+static const size_t CHECK_BLOCK_SIZE = 1 << 16;
+
+/*
+ record: magic, key length, etag length, value length, CRC-32 of key, etag and value
+ (big endian, 4 bytes each), then key, etag and value
+ */
+static void write32(std::string& out, uint32_t value) {
+    out.push_back(static_cast<char>(value >> 24));
+    out.push_back(static_cast<char>(value >> 16));
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+}
+
+static uint32_t read32(const unsigned char* in) {
+    return (uint32_t(in[0]) << 24) | (uint32_t(in[1]) << 16) | (uint32_t(in[2]) << 8) | uint32_t(in[3]);
+}
+
+// crc is continued from previous value, 0 for the first block
+static uint32_t crc32(uint32_t crc, const char* data, size_t size) {
+    static const struct table_type {
+        uint32_t values[256];
+        table_type() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t value = i;
+                for (int bit = 0; bit < 8; bit++) {
+                    value = (value & 1) ? (value >> 1) ^ 0xEDB88320 : value >> 1;
+                }
+                values[i] = value;
+            }
+        }
+    } table;
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table.values[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static bool write_all(int descriptor, const char* data, size_t size, off_t offset) {
+    while (size != 0) {
+        ssize_t written = pwrite(descriptor, data, size, offset);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+static bool read_all(int descriptor, char* data, size_t size, off_t offset) {
+    while (size != 0) {
+        ssize_t readed = pread(descriptor, data, size, offset);
+        if (readed == -1 && errno == EINTR) {
+            continue;
+        }
+        if (readed <= 0) {
+            return false;
+        }
+        data += readed;
+        size -= readed;
+        offset += readed;
+    }
+    return true;
+}
+
+disk_cache::segment::segment(int descriptor, uint64_t number, std::string path)
+    : descriptor(descriptor), number(number), path(std::move(path))
+{}
+
+disk_cache::segment::~segment() {
+    close(descriptor);
+}
+
+disk_cache::disk_cache(std::string const& directory, uint64_t max_size)
+    : directory(directory)
+    , max_size(max_size)
+    , segment_size(std::min(std::max(max_size / 16, MIN_SEGMENT_SIZE), MAX_SEGMENT_SIZE))
+{
+    if (mkdir(directory.c_str(), 0755) == -1 && errno != EEXIST) {
+        throw custom_exception("fail to create cache directory " + directory + ": " + std::strerror(errno));
+    }
+
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        throw custom_exception("fail to open cache directory " + directory + ": " + std::strerror(errno));
+    }
+    std::vector<uint64_t> numbers;
+    while (struct dirent* file = readdir(dir)) {
+        std::string name{file->d_name};
+        if (name.compare(0, SEGMENT_PREFIX.size(), SEGMENT_PREFIX) != 0 || name.size() == SEGMENT_PREFIX.size()) {
+            continue;
+        }
+        std::string number = name.substr(SEGMENT_PREFIX.size());
+        if (std::all_of(number.begin(), number.end(), ::isdigit)) {
+            numbers.push_back(std::stoull(number));
+        }
+    }
+    closedir(dir);
+    std::sort(numbers.begin(), numbers.end());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint64_t number: numbers) {
+        load_segment(number);
+    }
+
+    // older segments are never written again, new objects go to a fresh (or still empty) one
+    if (segments.size() == 0 || segments.back()->size != 0) {
+        open_segment(segments.size() == 0 ? 0 : segments.back()->number + 1);
+    }
+    evict();
+}
+
+std::string disk_cache::segment_path(uint64_t number) const {
+    return directory + "/" + SEGMENT_PREFIX + std::to_string(number);
+}
+
+void disk_cache::open_segment(uint64_t number) {
+    std::string path = segment_path(number);
+    int descriptor = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (descriptor == -1) {
+        throw custom_exception("fail to create cache segment " + path + ": " + std::strerror(errno));
+    }
+    segments.push_back(std::make_shared<segment>(descriptor, number, path));
+}
+
+void disk_cache::load_segment(uint64_t number) {
+    std::string path = segment_path(number);
+    int descriptor = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (descriptor == -1) {
+        return;
+    }
+    auto file = std::make_shared<segment>(descriptor, number, path);
+
+    struct stat info;
+    if (fstat(descriptor, &info) == -1) {
+        return;
+    }
+
+    //every record is checked, the first broken one and everything after it is dropped
+    off_t position = 0;
+    unsigned char header[RECORD_HEADER_SIZE];
+    std::vector<char> block(CHECK_BLOCK_SIZE);
+    while (position + static_cast<off_t>(RECORD_HEADER_SIZE) <= info.st_size) {
+        if (!read_all(descriptor, reinterpret_cast<char*>(header), RECORD_HEADER_SIZE, position)) {
+            break;
+        }
+        uint32_t key_size = read32(header + 4);
+        uint32_t etag_size = read32(header + 8);
+        uint32_t value_size = read32(header + 12);
+        off_t end = position + RECORD_HEADER_SIZE + key_size + etag_size + value_size;
+        if (read32(header) != MAGIC || key_size > MAX_KEY_SIZE || etag_size > MAX_ETAG_SIZE || end > info.st_size) {
+            break;
+        }
+
+        std::string names(key_size + etag_size, '\0');
+        if (!read_all(descriptor, &names[0], names.size(), position + RECORD_HEADER_SIZE)) {
+            break;
+        }
+        uint32_t crc = crc32(0, names.data(), names.size());
+        off_t value_position = end - value_size;
+        while (value_position < end) {
+            size_t size = static_cast<size_t>(std::min<off_t>(end - value_position, CHECK_BLOCK_SIZE));
+            if (!read_all(descriptor, block.data(), size, value_position)) {
+                break;
+            }
+            crc = crc32(crc, block.data(), size);
+            value_position += size;
+        }
+        if (value_position != end || crc != read32(header + 16)) {
+            break;
+        }
+
+        std::shared_ptr<entry> current = std::make_shared<entry>();
+        current->file = file;
+        current->offset = end - value_size;
+        current->length = value_size;
+        current->etag = names.substr(key_size);
+        index[names.substr(0, key_size)] = current;
+
+        position = end;
+    }
+
+    //torn tail of interrupted write or broken record, with everything after it
+    if (position < info.st_size && ftruncate(descriptor, position) == -1) {
+        position = info.st_size;
+    }
+    file->size = position;
+    total_size += position;
+    segments.push_back(file);
+}
+
+std::shared_ptr<const disk_cache::entry> disk_cache::find(std::string const& key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if (it == index.end()) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    return it->second;
+}
+
+void disk_cache::append(std::string const& key, std::string const& etag, std::string const& value) {
+    uint64_t record_size = RECORD_HEADER_SIZE + key.size() + etag.size() + value.size();
+    if (key.size() > MAX_KEY_SIZE || etag.size() > MAX_ETAG_SIZE || record_size > segment_size) {
+        return;
+    }
+
+    std::string header;
+    write32(header, MAGIC);
+    write32(header, static_cast<uint32_t>(key.size()));
+    write32(header, static_cast<uint32_t>(etag.size()));
+    write32(header, static_cast<uint32_t>(value.size()));
+    write32(header, crc32(crc32(crc32(0, key.data(), key.size()), etag.data(), etag.size()), value.data(), value.size()));
+    header += key;
+    header += etag;
+
+    //space is reserved under lock, writing itself doesn't block readers
+    std::shared_ptr<segment> file;
+    off_t position;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (segments.back()->size + record_size > segment_size) {
+            try {
+                open_segment(segments.back()->number + 1);
+            } catch (...) {
+                return;
+            }
+        }
+        file = segments.back();
+        position = file->size;
+        file->size += record_size;
+        total_size += record_size;
+    }
+
+    bool written = write_all(file->descriptor, header.data(), header.size(), position)
+                   && write_all(file->descriptor, value.data(), value.size(), position + header.size());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!written) {
+        //hole is skipped on the next start together with the rest of segment
+        return;
+    }
+
+    std::shared_ptr<entry> current = std::make_shared<entry>();
+    current->file = file;
+    current->offset = position + header.size();
+    current->length = value.size();
+    current->etag = etag;
+    // segment could be evicted while it was written
+    if (std::find(segments.begin(), segments.end(), file) != segments.end()) {
+        index[key] = current;
+    }
+    evict();
+}
+
+void disk_cache::evict() {
+    while (total_size > max_size && segments.size() > 1) {
+        std::shared_ptr<segment> oldest = segments.front();
+        segments.pop_front();
+
+        for (auto it = index.begin(); it != index.end(); ) {
+            if (it->second->file == oldest) {
+                it = index.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        // readers still holding it could finish, descriptor is closed with the last of them
+        unlink(oldest->path.c_str());
+        total_size -= oldest->size;
+    }
+}
+
+disk_cache::statistics disk_cache::get_statistics() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return statistics{index.size(), segments.size(), total_size, hits, misses};
+}
@@ -0,0 +1,105 @@
+//
+//  disk_cache.hpp
+//  simple_proxy
+//
+
+#ifndef disk_cache_hpp
+#define disk_cache_hpp
+
+#include <stdio.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <sys/types.h>
+
+/*
+ second tier of responce cache, survives restarts.
+ Objects are appended to segment files in directory, only index is kept in memory.
+ When directory grows over the limit, the oldest segment is deleted with all it's objects.
+ On start index is rebuilt by reading records of all segments, every record is checked by CRC-32.
+ Thread-safe, could be shared between reactors
+ */
+struct disk_cache {
+    // opened segment, stays readable while somebody holds it, even if it's deleted
+    struct segment {
+        segment(int descriptor, uint64_t number, std::string path);
+        ~segment();
+
+        segment(segment const&) = delete;
+        segment& operator=(segment const&) = delete;
+
+        int descriptor;
+        uint64_t number;
+        std::string path;
+        off_t size = 0;
+    };
+
+    struct entry {
+        std::shared_ptr<segment> file;
+        // position of stored responce inside file
+        off_t offset;
+        size_t length;
+        std::string etag;
+    };
+
+    struct statistics {
+        size_t entries;
+        size_t segments;
+        uint64_t bytes;
+        size_t hits;
+        size_t misses;
+    };
+
+    // throws custom_exception if directory couldn't be used
+    disk_cache(std::string const& directory, uint64_t max_size);
+
+    disk_cache(disk_cache const&) = delete;
+    disk_cache& operator=(disk_cache const&) = delete;
+
+    // returns nullptr if key isn't stored
+    std::shared_ptr<const entry> find(std::string const& key);
+
+    /*
+     blocking write, should be called from background thread.
+     Objects larger than segment size are ignored
+     */
+    void append(std::string const& key, std::string const& etag, std::string const& value);
+
+    uint64_t max_object_size() const {
+        return segment_size;
+    }
+
+    statistics get_statistics();
+private:
+    static const uint32_t MAGIC;
+    static const size_t RECORD_HEADER_SIZE;
+    static const uint64_t MIN_SEGMENT_SIZE;
+    static const uint64_t MAX_SEGMENT_SIZE;
+
+    std::string directory;
+    uint64_t max_size;
+    uint64_t segment_size;
+
+    std::mutex mutex;
+    // oldest first, last one is written
+    std::deque<std::shared_ptr<segment>> segments;
+    std::unordered_map<std::string, std::shared_ptr<const entry>> index;
+    uint64_t total_size = 0;
+
+    std::atomic<size_t> hits{0};
+    std::atomic<size_t> misses{0};
+
+    std::string segment_path(uint64_t number) const;
+
+    // mutex should be locked
+    void open_segment(uint64_t number);
+    void load_segment(uint64_t number);
+    void evict();
+};
+
+#endif /* disk_cache_hpp */
@@ -0,0 +1,86 @@
+//
+//  dns_cache.cpp
+//  simple_proxy
+//
+
+#include "dns_cache.hpp"
+
+#include <algorithm>
+
+const uint32_t dns_cache::MAX_TTL = 24 * 60 * 60;
+const uint32_t dns_cache::MAX_NEGATIVE_TTL = 60;
+const uint32_t dns_cache::DEFAULT_NEGATIVE_TTL = 5;
+const size_t dns_cache::PREFETCH_HITS = 8;
+
+dns_cache::dns_cache(size_t max_size)
+    : max_size(std::max<size_t>(max_size, 1))
+{}
+
+dns_cache::Lookup dns_cache::get(std::string const& host, std::vector<std::string>& addresses) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = entries.find(host);
+    if (it == entries.end()) {
+        return Lookup::MISS;
+    }
+
+    entry& current = it->second;
+    clock::time_point now = clock::now();
+    if (now >= current.expires) {
+        erase(it);
+        return Lookup::MISS;
+    }
+
+    order.splice(order.begin(), order, current.position);
+    current.hits++;
+    addresses = current.addresses;
+
+    //popular entry in the last tenth of it's life is refreshed in advance
+    if (!current.refreshing && current.addresses.size() != 0 && current.hits >= PREFETCH_HITS
+        && (current.expires - now) * 10 <= current.ttl) {
+        current.refreshing = true;
+        return Lookup::HIT_REFRESH;
+    }
+    return Lookup::HIT;
+}
+
+void dns_cache::put(std::string const& host, std::vector<std::string> const& addresses, uint32_t ttl) {
+    if (ttl == 0 || addresses.size() == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    store(host, addresses, std::min(ttl, MAX_TTL));
+}
+
+void dns_cache::put_negative(std::string const& host, uint32_t ttl) {
+    std::lock_guard<std::mutex> lock(mutex);
+    store(host, std::vector<std::string>(), ttl == 0 ? DEFAULT_NEGATIVE_TTL : std::min(ttl, MAX_NEGATIVE_TTL));
+}
+
+void dns_cache::store(std::string const& host, std::vector<std::string> const& addresses, uint32_t ttl) {
+    auto it = entries.find(host);
+    if (it == entries.end()) {
+        order.push_front(host);
+        it = entries.emplace(host, entry()).first;
+        it->second.position = order.begin();
+    } else {
+        order.splice(order.begin(), order, it->second.position);
+    }
+
+    entry& current = it->second;
+    current.addresses = addresses;
+    current.ttl = std::chrono::seconds(ttl);
+    current.expires = clock::now() + current.ttl;
+    current.hits = 0;
+    current.refreshing = false;
+
+    if (entries.size() > max_size) {
+        erase(entries.find(order.back()));
+    }
+}
+
+void dns_cache::erase(std::unordered_map<std::string, entry>::iterator it) {
+    order.erase(it->second.position);
+    entries.erase(it);
+}
@@ -0,0 +1,76 @@
+//
+//  dns_cache.hpp
+//  simple_proxy
+//
+
+#ifndef dns_cache_hpp
+#define dns_cache_hpp
+
+#include <stdio.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <chrono>
+#include <mutex>
+
+/*
+ LRU cache of resolved names, entries live as long as record TTL says.
+ Names which don't exist are cached too (negative entries, no addresses).
+ Could be shared between several resolvers running in different threads
+ */
+struct dns_cache {
+    enum class Lookup {
+        MISS,
+        HIT,
+        // entry is fresh, but popular and expires soon: caller should refresh it
+        HIT_REFRESH
+    };
+
+    dns_cache(size_t max_size);
+
+    dns_cache(dns_cache const&) = delete;
+    dns_cache& operator=(dns_cache const&) = delete;
+
+    /*
+     on hit addresses are filled, empty addresses mean that name doesn't exist.
+     HIT_REFRESH is returned only once per entry until it's updated with put
+     */
+    Lookup get(std::string const& host, std::vector<std::string>& addresses);
+
+    // ttl is in seconds, entries with zero ttl are not cached
+    void put(std::string const& host, std::vector<std::string> const& addresses, uint32_t ttl);
+
+    // negative answer, cached for short time only
+    void put_negative(std::string const& host, uint32_t ttl);
+private:
+    using clock = std::chrono::steady_clock;
+
+    static const uint32_t MAX_TTL; // seconds
+    static const uint32_t MAX_NEGATIVE_TTL; // seconds
+    static const uint32_t DEFAULT_NEGATIVE_TTL; // seconds, if there was no SOA in answer
+    static const size_t PREFETCH_HITS;
+
+    struct entry {
+        std::vector<std::string> addresses;
+        clock::time_point expires;
+        clock::duration ttl;
+        size_t hits = 0;
+        bool refreshing = false;
+        std::list<std::string>::iterator position;
+    };
+
+    size_t max_size;
+    // most recently used first
+    std::list<std::string> order;
+    std::unordered_map<std::string, entry> entries;
+
+    std::mutex mutex;
+
+    // mutex should be locked
+    void store(std::string const& host, std::vector<std::string> const& addresses, uint32_t ttl);
+    void erase(std::unordered_map<std::string, entry>::iterator it);
+};
+
+#endif /* dns_cache_hpp */
@@ -0,0 +1,655 @@
+//
+//  dns_resolver.cpp
+//  simple_proxy
+//
+
+#include "dns_resolver.hpp"
+#include "custom_exception.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+const int dns_resolver::TICK = 100;
+const uint16_t dns_resolver::TYPE_A;
+const uint16_t dns_resolver::TYPE_AAAA;
+
+static const uint16_t TYPE_SOA = 6;
+static const size_t HEADER_SIZE = 12;
+static const size_t MAX_UDP_SIZE = 512;
+
+static const int RCODE_OK = 0;
+static const int RCODE_NXDOMAIN = 3;
+
+static int make_socket(int family, int type) {
+    int s = ::socket(family, type, 0);
+    if (s == -1) {
+        return -1;
+    }
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+    fcntl(s, F_SETFD, FD_CLOEXEC);
+    return s;
+}
+
+static socklen_t address_size(struct sockaddr_storage const& address) {
+    return address.ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+static bool same_address(struct sockaddr_storage const& a, struct sockaddr_storage const& b) {
+    if (a.ss_family != b.ss_family) {
+        return false;
+    }
+    if (a.ss_family == AF_INET) {
+        auto& x = reinterpret_cast<struct sockaddr_in const&>(a);
+        auto& y = reinterpret_cast<struct sockaddr_in const&>(b);
+        return x.sin_port == y.sin_port && x.sin_addr.s_addr == y.sin_addr.s_addr;
+    }
+    auto& x = reinterpret_cast<struct sockaddr_in6 const&>(a);
+    auto& y = reinterpret_cast<struct sockaddr_in6 const&>(b);
+    return x.sin6_port == y.sin6_port && std::memcmp(&x.sin6_addr, &y.sin6_addr, sizeof(x.sin6_addr)) == 0;
+}
+
+static bool parse_address(std::string const& ip, uint16_t port, struct sockaddr_storage& result) {
+    std::memset(&result, 0, sizeof(result));
+    auto& v4 = reinterpret_cast<struct sockaddr_in&>(result);
+    if (inet_pton(AF_INET, ip.c_str(), &v4.sin_addr) == 1) {
+        v4.sin_family = AF_INET;
+        v4.sin_port = htons(port);
+        return true;
+    }
+    auto& v6 = reinterpret_cast<struct sockaddr_in6&>(result);
+    if (inet_pton(AF_INET6, ip.c_str(), &v6.sin6_addr) == 1) {
+        v6.sin6_family = AF_INET6;
+        v6.sin6_port = htons(port);
+        return true;
+    }
+    return false;
+}
+
+static uint16_t read16(std::string const& data, size_t pos) {
+    return static_cast<uint16_t>((static_cast<uint8_t>(data[pos]) << 8) | static_cast<uint8_t>(data[pos + 1]));
+}
+
+static uint32_t read32(std::string const& data, size_t pos) {
+    return (static_cast<uint32_t>(read16(data, pos)) << 16) | read16(data, pos + 2);
+}
+
+/*
+ moves pos after (possibly compressed) name
+ returns false if packet is broken
+ */
+static bool skip_name(std::string const& data, size_t& pos) {
+    while (pos < data.size()) {
+        uint8_t len = static_cast<uint8_t>(data[pos]);
+        if ((len & 0xC0) == 0xC0) {
+            pos += 2;
+            return pos <= data.size();
+        }
+        pos++;
+        if (len == 0) {
+            return true;
+        }
+        pos += len;
+    }
+    return false;
+}
+
+static std::string to_lower(std::string str) {
+    std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+    return str;
+}
+
+dns_resolver::dns_resolver(event_queue* queue, dns_cache* cache)
+    : queue(queue)
+    , cache(cache)
+    , random(std::random_device{}())
+{
+    load_resolv_conf();
+    load_hosts();
+
+    udp4 = make_socket(AF_INET, SOCK_DGRAM);
+    udp6 = make_socket(AF_INET6, SOCK_DGRAM);
+    if (udp4 == -1) {
+        throw custom_exception("fail to create resolver socket");
+    }
+
+    udp4_read = event_registration{queue, udp4, FILTER_READ, [this](queue_event& event) {
+        on_udp_read(udp4);
+    }, true};
+    if (udp6 != -1) {
+        udp6_read = event_registration{queue, udp6, FILTER_READ, [this](queue_event& event) {
+            on_udp_read(udp6);
+        }, true};
+    }
+    // socket descriptor is unique, so it's safe to use it as timer ident
+    timer = event_registration{queue, udp4, FILTER_TIMER, 0, TICK, [this](queue_event& event) {
+        on_timer();
+    }};
+}
+
+dns_resolver::~dns_resolver() {
+    for (auto& l: lookups) {
+        close_tcp(l.second->queries[0]);
+        close_tcp(l.second->queries[1]);
+    }
+    timer.invalidate();
+    udp4_read.invalidate();
+    udp6_read.invalidate();
+    close(udp4);
+    if (udp6 != -1) {
+        close(udp6);
+    }
+}
+
+void dns_resolver::load_resolv_conf() {
+    std::ifstream in("/etc/resolv.conf");
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream tokens(line);
+        std::string key;
+        tokens >> key;
+        if (key == "nameserver") {
+            std::string ip;
+            tokens >> ip;
+            struct sockaddr_storage address;
+            if (parse_address(ip, 53, address)) {
+                nameservers.push_back(address);
+            }
+        } else if (key == "options") {
+            std::string option;
+            while (tokens >> option) {
+                if (option.compare(0, 8, "timeout:") == 0) {
+                    timeout = std::max(1, std::atoi(option.c_str() + 8)) * 1000;
+                } else if (option.compare(0, 9, "attempts:") == 0) {
+                    attempts = std::max(1, std::atoi(option.c_str() + 9));
+                }
+            }
+        }
+    }
+
+    if (nameservers.size() == 0) {
+        struct sockaddr_storage address;
+        parse_address("127.0.0.1", 53, address);
+        nameservers.push_back(address);
+    }
+}
+
+bool dns_resolver::set_nameserver(std::string const& ip, uint16_t port) {
+    struct sockaddr_storage address;
+    if (!parse_address(ip, port, address)) {
+        return false;
+    }
+    nameservers.assign(1, address);
+    return true;
+}
+
+void dns_resolver::load_hosts() {
+    std::ifstream in("/etc/hosts");
+    std::string line;
+    while (std::getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream tokens(line);
+        std::string ip;
+        std::string name;
+        struct sockaddr_storage address;
+        if (!(tokens >> ip) || !parse_address(ip, 0, address)) {
+            continue;
+        }
+        while (tokens >> name) {
+            auto& addresses = hosts[to_lower(name)];
+            if (address.ss_family == AF_INET) {
+                addresses.insert(addresses.begin(), ip);
+            } else {
+                addresses.push_back(ip);
+            }
+        }
+    }
+}
+
+int64_t dns_resolver::monotonic_now() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint16_t dns_resolver::make_id() {
+    uint16_t id;
+    do {
+        id = static_cast<uint16_t>(random());
+    } while (by_id.find(id) != by_id.end());
+    return id;
+}
+
+std::string dns_resolver::make_packet(uint16_t id, std::string const& host, uint16_t type) {
+    std::string packet;
+    packet += static_cast<char>(id >> 8);
+    packet += static_cast<char>(id & 0xFF);
+    // recursion desired
+    packet += '\x01';
+    packet += '\x00';
+    // one question
+    packet += std::string("\x00\x01\x00\x00\x00\x00\x00\x00", 8);
+
+    size_t begin = 0;
+    while (begin < host.size()) {
+        size_t end = host.find('.', begin);
+        if (end == std::string::npos) {
+            end = host.size();
+        }
+        if (end - begin == 0 || end - begin > 63) {
+            throw custom_exception("invalid host name");
+        }
+        packet += static_cast<char>(end - begin);
+        packet += host.substr(begin, end - begin);
+        begin = end + 1;
+    }
+    packet += '\x00';
+
+    packet += static_cast<char>(type >> 8);
+    packet += static_cast<char>(type & 0xFF);
+    // class IN
+    packet += '\x00';
+    packet += '\x01';
+    return packet;
+}
+
+std::string dns_resolver::normalize(std::string const& host_name) {
+    std::string host = to_lower(host_name);
+    if (host.size() != 0 && host.back() == '.') {
+        host.pop_back();
+    }
+    return host;
+}
+
+bool dns_resolver::resolve_locally(std::string const& host, result& answer) {
+    struct sockaddr_storage address;
+    if (parse_address(host, 0, address)) {
+        answer.status = Status::OK;
+        answer.addresses.push_back(host);
+        return true;
+    }
+    auto it = hosts.find(host);
+    if (it != hosts.end()) {
+        answer.status = Status::OK;
+        answer.addresses = it->second;
+        return true;
+    }
+    if (host.size() == 0 || host.size() > 253) {
+        answer.status = Status::NOT_FOUND;
+        return true;
+    }
+    return false;
+}
+
+bool dns_resolver::resolve_cached(std::string const& host_name, result& answer) {
+    std::string host = normalize(host_name);
+    if (resolve_locally(host, answer)) {
+        return true;
+    }
+    if (!cache) {
+        return false;
+    }
+
+    dns_cache::Lookup found = cache->get(host, answer.addresses);
+    if (found == dns_cache::Lookup::MISS) {
+        return false;
+    }
+    answer.status = answer.addresses.size() != 0 ? Status::OK : Status::NOT_FOUND;
+
+    if (found == dns_cache::Lookup::HIT_REFRESH && lookups.find(host) == lookups.end()) {
+        //nobody waits for it, answer only updates cache
+        finished.clear();
+        start(make_lookup(host));
+    }
+    return true;
+}
+
+void dns_resolver::resolve(std::string const& host_name, callback cb) {
+    finished.clear();
+
+    std::string host = normalize(host_name);
+
+    result immediate;
+    if (resolve_locally(host, immediate)) {
+        queue->execute_in_main(task{[cb, immediate]() {
+            cb(immediate);
+        }});
+        return;
+    }
+
+    auto it = lookups.find(host);
+    if (it != lookups.end()) {
+        it->second->callbacks.push_back(std::move(cb));
+        return;
+    }
+
+    lookup& current = make_lookup(host);
+    current.callbacks.push_back(std::move(cb));
+    start(current);
+}
+
+dns_resolver::lookup& dns_resolver::make_lookup(std::string const& host) {
+    std::unique_ptr<lookup> l(new lookup());
+    l->host = host;
+    l->queries[0].type = TYPE_A;
+    l->queries[1].type = TYPE_AAAA;
+
+    lookup& current = *l;
+    lookups[host] = std::move(l);
+    return current;
+}
+
+void dns_resolver::start(lookup& l) {
+    try {
+        for (auto& q: l.queries) {
+            q.id = make_id();
+            q.packet = make_packet(q.id, l.host, q.type);
+            by_id[q.id] = &l;
+        }
+    } catch (std::exception const& e) {
+        l.status = Status::NOT_FOUND;
+        l.ttl = 0;
+        complete(l);
+        return;
+    }
+
+    if (!timer_active) {
+        timer.resume_listen();
+        timer_active = true;
+    }
+    send(l);
+}
+
+void dns_resolver::send(lookup& l) {
+    l.deadline = monotonic_now() + timeout;
+    for (auto& q: l.queries) {
+        if (!q.done) {
+            send_udp(l, q);
+        }
+    }
+}
+
+void dns_resolver::send_udp(lookup& l, query& q) {
+    struct sockaddr_storage const& server = nameservers[l.server];
+    int s = server.ss_family == AF_INET6 ? udp6 : udp4;
+    if (s == -1) {
+        return;
+    }
+    // on failure query will be repeated by timeout
+    sendto(s, q.packet.data(), q.packet.size(), 0, reinterpret_cast<struct sockaddr const*>(&server), address_size(server));
+}
+
+void dns_resolver::on_udp_read(int s) {
+    char data[MAX_UDP_SIZE];
+    while (true) {
+        struct sockaddr_storage from;
+        socklen_t from_size = sizeof(from);
+        ssize_t len = recvfrom(s, data, sizeof(data), 0, reinterpret_cast<struct sockaddr*>(&from), &from_size);
+        if (len < 0) {
+            return;
+        }
+        if (static_cast<size_t>(len) < HEADER_SIZE) {
+            continue;
+        }
+
+        std::string packet(data, static_cast<size_t>(len));
+        auto it = by_id.find(read16(packet, 0));
+        if (it == by_id.end()) {
+            continue;
+        }
+        lookup& l = *it->second;
+        if (!same_address(from, nameservers[l.server])) {
+            continue;
+        }
+        for (auto& q: l.queries) {
+            if (q.id == it->first && !q.done && q.tcp_socket == -1) {
+                handle_answer(l, q, packet, false);
+                break;
+            }
+        }
+    }
+}
+
+bool dns_resolver::handle_answer(lookup& l, query& q, std::string const& packet, bool over_tcp) {
+    uint16_t flags = read16(packet, 2);
+    if (!(flags & 0x8000) || packet.compare(HEADER_SIZE, q.packet.size() - HEADER_SIZE, q.packet, HEADER_SIZE, std::string::npos) != 0) {
+        // not a response or response to another question
+        return false;
+    }
+
+    if ((flags & 0x0200) && !over_tcp) {
+        // truncated, repeat over TCP
+        start_tcp(l, q);
+        return true;
+    }
+
+    int rcode = flags & 0x000F;
+    if (rcode != RCODE_OK && rcode != RCODE_NXDOMAIN) {
+        // server failure, ask next one
+        next_server(l);
+        return true;
+    }
+
+    size_t pos = HEADER_SIZE;
+    uint16_t questions = read16(packet, 4);
+    uint16_t answers = read16(packet, 6);
+    uint16_t authority = read16(packet, 8);
+    for (uint16_t i = 0; i < questions; i++) {
+        if (!skip_name(packet, pos)) {
+            return false;
+        }
+        pos += 4;
+    }
+
+    for (uint32_t i = 0; i < static_cast<uint32_t>(answers) + authority; i++) {
+        if (!skip_name(packet, pos) || pos + 10 > packet.size()) {
+            break;
+        }
+        uint16_t type = read16(packet, pos);
+        uint32_t ttl = read32(packet, pos + 4);
+        uint16_t length = read16(packet, pos + 8);
+        pos += 10;
+        if (pos + length > packet.size()) {
+            break;
+        }
+
+        char ip[INET6_ADDRSTRLEN];
+        if (i < answers && type == TYPE_A && length == 4 && q.type == TYPE_A) {
+            inet_ntop(AF_INET, packet.data() + pos, ip, sizeof(ip));
+            l.ipv4.push_back(ip);
+            l.ttl = std::min(l.ttl, ttl);
+        } else if (i < answers && type == TYPE_AAAA && length == 16 && q.type == TYPE_AAAA) {
+            inet_ntop(AF_INET6, packet.data() + pos, ip, sizeof(ip));
+            l.ipv6.push_back(ip);
+            l.ttl = std::min(l.ttl, ttl);
+        } else if (i >= answers && type == TYPE_SOA && l.ipv4.size() == 0 && l.ipv6.size() == 0) {
+            // negative answer could be cached for min(ttl, SOA minimum)
+            size_t soa = pos;
+            if (skip_name(packet, soa) && skip_name(packet, soa) && soa + 20 <= pos + length) {
+                l.ttl = std::min(l.ttl, std::min(ttl, read32(packet, soa + 16)));
+            }
+        }
+        pos += length;
+    }
+
+    if (rcode == RCODE_NXDOMAIN) {
+        // there is no such name at all, other query is not needed
+        l.status = Status::NOT_FOUND;
+        for (auto& other: l.queries) {
+            finish_query(l, other);
+        }
+    } else {
+        finish_query(l, q);
+    }
+
+    if (l.queries[0].done && l.queries[1].done) {
+        complete(l);
+    }
+    return true;
+}
+
+void dns_resolver::finish_query(lookup& l, query& q) {
+    q.done = true;
+    auto it = by_id.find(q.id);
+    if (it != by_id.end() && it->second == &l) {
+        by_id.erase(it);
+    }
+    close_tcp(q);
+}
+
+void dns_resolver::next_server(lookup& l) {
+    l.server++;
+    if (l.server == nameservers.size()) {
+        l.server = 0;
+        l.attempt++;
+    }
+
+    if (l.attempt >= attempts) {
+        l.status = Status::FAILED;
+        for (auto& q: l.queries) {
+            finish_query(l, q);
+        }
+        complete(l);
+        return;
+    }
+
+    for (auto& q: l.queries) {
+        close_tcp(q);
+    }
+    send(l);
+}
+
+void dns_resolver::start_tcp(lookup& l, query& q) {
+    struct sockaddr_storage const& server = nameservers[l.server];
+    q.tcp_socket = make_socket(server.ss_family, SOCK_STREAM);
+    if (q.tcp_socket == -1) {
+        return;
+    }
+    connect(q.tcp_socket, reinterpret_cast<struct sockaddr const*>(&server), address_size(server));
+
+    q.tcp_buffer.clear();
+    q.tcp_buffer += static_cast<char>(q.packet.size() >> 8);
+    q.tcp_buffer += static_cast<char>(q.packet.size() & 0xFF);
+    q.tcp_buffer += q.packet;
+    q.tcp_sent = 0;
+
+    lookup* lp = &l;
+    query* qp = &q;
+    q.tcp_write = event_registration{queue, q.tcp_socket, FILTER_WRITE, [this, lp, qp](queue_event& event) {
+        on_tcp_write(*lp, *qp);
+    }, true};
+    q.tcp_read = event_registration{queue, q.tcp_socket, FILTER_READ, [this, lp, qp](queue_event& event) {
+        on_tcp_read(*lp, *qp);
+    }};
+}
+
+void dns_resolver::close_tcp(query& q) {
+    if (q.tcp_socket == -1) {
+        return;
+    }
+    q.tcp_read.invalidate();
+    q.tcp_write.invalidate();
+    close(q.tcp_socket);
+    q.tcp_socket = -1;
+}
+
+void dns_resolver::on_tcp_write(lookup& l, query& q) {
+#ifdef MSG_NOSIGNAL
+    ssize_t len = ::send(q.tcp_socket, q.tcp_buffer.data() + q.tcp_sent, q.tcp_buffer.size() - q.tcp_sent, MSG_NOSIGNAL);
+#else
+    ssize_t len = ::send(q.tcp_socket, q.tcp_buffer.data() + q.tcp_sent, q.tcp_buffer.size() - q.tcp_sent, 0);
+#endif
+    if (len <= 0) {
+        next_server(l);
+        return;
+    }
+    q.tcp_sent += static_cast<size_t>(len);
+    if (q.tcp_sent == q.tcp_buffer.size()) {
+        q.tcp_buffer.clear();
+        q.tcp_write.stop_listen();
+        q.tcp_read.resume_listen();
+    }
+}
+
+void dns_resolver::on_tcp_read(lookup& l, query& q) {
+    char data[4096];
+    ssize_t len = recv(q.tcp_socket, data, sizeof(data), 0);
+    if (len <= 0) {
+        next_server(l);
+        return;
+    }
+    q.tcp_buffer.append(data, static_cast<size_t>(len));
+
+    if (q.tcp_buffer.size() < 2) {
+        return;
+    }
+    size_t expected = read16(q.tcp_buffer, 0);
+    if (q.tcp_buffer.size() < expected + 2) {
+        return;
+    }
+
+    std::string packet = q.tcp_buffer.substr(2, expected);
+    if (packet.size() < HEADER_SIZE || read16(packet, 0) != q.id || !handle_answer(l, q, packet, true)) {
+        next_server(l);
+    }
+}
+
+void dns_resolver::on_timer() {
+    finished.clear();
+
+    int64_t current = monotonic_now();
+    std::vector<lookup*> expired;
+    for (auto& l: lookups) {
+        if (l.second->deadline <= current) {
+            expired.push_back(l.second.get());
+        }
+    }
+    for (lookup* l: expired) {
+        next_server(*l);
+    }
+
+    if (lookups.size() == 0 && timer_active) {
+        timer.stop_listen();
+        timer_active = false;
+    }
+}
+
+void dns_resolver::complete(lookup& l) {
+    result answer;
+    answer.addresses = l.ipv4;
+    answer.addresses.insert(answer.addresses.end(), l.ipv6.begin(), l.ipv6.end());
+
+    if (answer.addresses.size() != 0) {
+        answer.status = Status::OK;
+    } else if (l.status == Status::FAILED) {
+        answer.status = Status::FAILED;
+    } else {
+        // NXDOMAIN or no records of both types
+        answer.status = Status::NOT_FOUND;
+    }
+    answer.ttl = (l.ttl == UINT32_MAX) ? 0 : l.ttl;
+
+    if (cache && answer.status == Status::OK) {
+        cache->put(l.host, answer.addresses, answer.ttl);
+    } else if (cache && answer.status == Status::NOT_FOUND) {
+        cache->put_negative(l.host, answer.ttl);
+    }
+
+    for (auto& q: l.queries) {
+        finish_query(l, q);
+    }
+
+    auto it = lookups.find(l.host);
+    std::unique_ptr<lookup> current = std::move(it->second);
+    lookups.erase(it);
+
+    // callbacks could start new lookups
+    for (auto& cb: current->callbacks) {
+        cb(answer);
+    }
+    finished.push_back(std::move(current));
+}
@@ -0,0 +1,157 @@
+//
+//  dns_resolver.hpp
+//  simple_proxy
+//
+
+#ifndef dns_resolver_hpp
+#define dns_resolver_hpp
+
+#include <stdio.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <random>
+#include <functional>
+#include <sys/socket.h>
+
+#include "event_queue.hpp"
+#include "event_registration.h"
+#include "dns_cache.hpp"
+
+/*
+ non-blocking DNS stub resolver working inside event_queue.
+ Nameservers, timeout and attempts are taken from /etc/resolv.conf,
+ A and AAAA queries are sent over UDP and repeated over TCP if answer is truncated.
+ IP literals, /etc/hosts and cached names are answered without network
+ */
+struct dns_resolver {
+    enum class Status {OK, NOT_FOUND, FAILED};
+
+    struct result {
+        Status status = Status::FAILED;
+        // IPv4 addresses first
+        std::vector<std::string> addresses;
+        // how long result could be cached, seconds
+        uint32_t ttl = 0;
+    };
+
+    using callback = std::function<void(result const&)>;
+
+    // cache could be shared between resolvers of different threads, nullptr disables caching
+    dns_resolver(event_queue* queue, dns_cache* cache = nullptr);
+    ~dns_resolver();
+
+    dns_resolver(dns_resolver const&) = delete;
+    dns_resolver& operator=(dns_resolver const&) = delete;
+
+    /*
+     callback is always invoked later from event loop,
+     concurrent requests of the same host share one lookup
+     */
+    void resolve(std::string const& host, callback cb);
+
+    /*
+     answers IP literals, /etc/hosts and cached names right away,
+     returns false if network lookup is needed.
+     Popular cached names are refreshed in background before they expire
+     */
+    bool resolve_cached(std::string const& host, result& answer);
+
+    /*
+     replaces nameservers of resolv.conf by the one given (IP literal),
+     should be called before the first lookup. Returns false if address is invalid
+     */
+    bool set_nameserver(std::string const& ip, uint16_t port);
+private:
+    static const int TICK; // milliseconds
+    static const uint16_t TYPE_A = 1;
+    static const uint16_t TYPE_AAAA = 28;
+
+    struct lookup;
+
+    // one DNS question (A or AAAA) of lookup
+    struct query {
+        uint16_t id = 0;
+        uint16_t type = 0;
+        bool done = false;
+        std::string packet;
+
+        // TCP fallback
+        int tcp_socket = -1;
+        std::string tcp_buffer;
+        size_t tcp_sent = 0;
+        event_registration tcp_read;
+        event_registration tcp_write;
+    };
+
+    struct lookup {
+        std::string host;
+        std::vector<callback> callbacks;
+        query queries[2];
+        std::vector<std::string> ipv4;
+        std::vector<std::string> ipv6;
+        uint32_t ttl = UINT32_MAX;
+        size_t server = 0;
+        int attempt = 0;
+        int64_t deadline = 0;
+        // NOT_FOUND if name doesn't exist, FAILED if all servers failed
+        Status status = Status::OK;
+    };
+
+    event_queue* queue;
+    dns_cache* cache;
+
+    std::vector<struct sockaddr_storage> nameservers;
+    int timeout = 5000; // milliseconds
+    int attempts = 2;
+    std::map<std::string, std::vector<std::string>> hosts;
+
+    int udp4 = -1;
+    int udp6 = -1;
+    event_registration udp4_read;
+    event_registration udp6_read;
+    event_registration timer;
+    bool timer_active = false;
+
+    std::mt19937 random;
+
+    std::unordered_map<std::string, std::unique_ptr<lookup>> lookups;
+    // completed lookups, destroyed out of their own handlers
+    std::vector<std::unique_ptr<lookup>> finished;
+    // query id -> lookup
+    std::unordered_map<uint16_t, lookup*> by_id;
+
+    void load_resolv_conf();
+    void load_hosts();
+
+    static std::string normalize(std::string const& host);
+    // returns false if name has to be looked up
+    bool resolve_locally(std::string const& host, result& answer);
+    lookup& make_lookup(std::string const& host);
+
+    void start(lookup& l);
+    void send(lookup& l);
+    void send_udp(lookup& l, query& q);
+    void start_tcp(lookup& l, query& q);
+    void close_tcp(query& q);
+
+    void on_udp_read(int socket);
+    void on_tcp_write(lookup& l, query& q);
+    void on_tcp_read(lookup& l, query& q);
+    void on_timer();
+
+    // returns false if packet doesn't answer query
+    bool handle_answer(lookup& l, query& q, std::string const& packet, bool over_tcp);
+    void finish_query(lookup& l, query& q);
+    void next_server(lookup& l);
+    void complete(lookup& l);
+
+    uint16_t make_id();
+    static std::string make_packet(uint16_t id, std::string const& host, uint16_t type);
+    static int64_t monotonic_now();
+};
+
+#endif /* dns_resolver_hpp */
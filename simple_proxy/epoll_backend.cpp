@@ -0,0 +1,379 @@
+//
+//  epoll_backend.cpp
+//  simple_proxy
+//
+
+#include "epoll_backend.hpp"
+
+#ifdef SIMPLE_PROXY_EPOLL
+
+#include <unistd.h>
+#include <signal.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include "custom_exception.hpp"
+
+const int epoll_backend::EVENTS_AMOUNT;
+
+static void throw_error(std::string message) {
+    message.append(std::strerror(errno));
+    throw custom_exception(message);
+}
+
+epoll_backend::epoll_backend() {
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        throw_error("epoll_create fails: ");
+    }
+}
+
+epoll_backend::~epoll_backend() {
+    for (auto& timer: timers) {
+        close(timer.second);
+    }
+    for (int fd: free_timers) {
+        close(fd);
+    }
+    for (auto& signal: signals) {
+        close(signal.second);
+    }
+    close(epfd);
+}
+
+epoll_backend::slot& epoll_backend::get_slot(int fd) {
+    if (static_cast<size_t>(fd) >= slots.size()) {
+        slots.resize(std::max(static_cast<size_t>(fd) + 1, slots.size() * 2));
+    }
+    return slots[fd];
+}
+
+void epoll_backend::mark_changed(int fd, slot& s) {
+    if (!s.read && !s.write) {
+        // descriptor could be closed and reused before flush
+        s.dropped = true;
+    }
+    if (!s.changed) {
+        s.changed = true;
+        changed.push_back(fd);
+    }
+}
+
+void epoll_backend::flush() {
+    for (int fd: changed) {
+        slot& s = slots[fd];
+        s.changed = false;
+        if (s.kind == Kind::TIMER) {
+            apply_timer(fd, s);
+        } else if (s.kind == Kind::SOCKET) {
+            apply(fd, s);
+        }
+    }
+    changed.clear();
+}
+
+void epoll_backend::apply(int fd, slot& s) {
+    uint32_t mask = 0;
+    if (s.read) {
+        mask |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (s.write) {
+        mask |= EPOLLOUT;
+    }
+    if (mask != 0 && s.edge) {
+        mask |= EPOLLET;
+    }
+
+    bool dropped = s.dropped;
+    s.dropped = false;
+    /*
+     if interest was dropped in between, descriptor could be closed and reopened,
+     so kernel state has to be checked with EPOLL_CTL_MOD even if mask is the same
+     */
+    if (mask == s.mask && !(dropped && mask != 0)) {
+        return;
+    }
+
+    struct epoll_event temp_event;
+    temp_event.events = mask;
+    temp_event.data.fd = fd;
+
+    if (mask == 0) {
+        /*
+         descriptor could be already closed, which removes it from epoll.
+         Another thread could reopen it meanwhile as a regular file, which can't be polled (EPERM)
+         */
+        if (epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &temp_event) == -1 && errno != ENOENT && errno != EBADF && errno != EPERM) {
+            throw_error("epoll_ctl fails: ");
+        }
+        s.kind = Kind::NONE;
+    } else if (s.mask == 0) {
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &temp_event) == -1) {
+            throw_error("epoll_ctl fails: ");
+        }
+    } else if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &temp_event) == -1) {
+        // descriptor was closed and reopened without remove
+        if (errno != ENOENT || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &temp_event) == -1) {
+            throw_error("epoll_ctl fails: ");
+        }
+    }
+    s.mask = mask;
+}
+
+void epoll_backend::apply_timer(int fd, slot& s) {
+    struct itimerspec spec;
+    std::memset(&spec, 0, sizeof(spec));
+
+    if (s.read) {
+        // periodic, like kqueue timers
+        spec.it_value.tv_sec = s.period / 1000;
+        spec.it_value.tv_nsec = (s.period % 1000) * 1000000;
+        spec.it_interval = spec.it_value;
+    } else {
+        // removed: disarm and keep descriptor for the next timer
+        timers.erase(s.ident);
+        free_timers.push_back(fd);
+    }
+
+    if (timerfd_settime(fd, 0, &spec, nullptr) == -1) {
+        throw_error("timerfd_settime fails: ");
+    }
+}
+
+void epoll_backend::add(size_t ident, int16_t filter, uint16_t flags, intptr_t data, handler* hand) {
+    switch (filter) {
+        case FILTER_READ:
+        case FILTER_WRITE: {
+            int fd = static_cast<int>(ident);
+            slot& s = get_slot(fd);
+            s.kind = Kind::SOCKET;
+            s.ident = ident;
+            s.edge = (flags & FLAG_EDGE) != 0;
+            if (filter == FILTER_READ) {
+                s.read = hand;
+            } else {
+                s.write = hand;
+            }
+            mark_changed(fd, s);
+            break;
+        }
+        case FILTER_TIMER:
+            add_timer(ident, data, hand);
+            break;
+        case FILTER_SIGNAL:
+            add_signal(ident, hand);
+            break;
+        default:
+            throw custom_exception("epoll: unknown filter");
+    }
+}
+
+void epoll_backend::remove(size_t ident, int16_t filter) {
+    switch (filter) {
+        case FILTER_READ:
+        case FILTER_WRITE: {
+            int fd = static_cast<int>(ident);
+            if (static_cast<size_t>(fd) >= slots.size() || slots[fd].kind != Kind::SOCKET) {
+                return;
+            }
+            slot& s = slots[fd];
+            if (filter == FILTER_READ) {
+                s.read = nullptr;
+            } else {
+                s.write = nullptr;
+            }
+            mark_changed(fd, s);
+            break;
+        }
+        case FILTER_TIMER:
+            remove_timer(ident);
+            break;
+        case FILTER_SIGNAL:
+            remove_signal(ident);
+            break;
+        default:
+            throw custom_exception("epoll: unknown filter");
+    }
+}
+
+void epoll_backend::add_timer(size_t ident, intptr_t data, handler* hand) {
+    int fd;
+    auto it = timers.find(ident);
+    if (it != timers.end()) {
+        fd = it->second;
+    } else if (free_timers.size() != 0) {
+        fd = free_timers.back();
+        free_timers.pop_back();
+        timers[ident] = fd;
+    } else {
+        fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fd == -1) {
+            throw_error("timerfd_create fails: ");
+        }
+
+        struct epoll_event temp_event;
+        temp_event.events = EPOLLIN;
+        temp_event.data.fd = fd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &temp_event) == -1) {
+            close(fd);
+            throw_error("epoll_ctl fails: ");
+        }
+        timers[ident] = fd;
+
+        // slot could be left from closed socket with the same descriptor
+        slot& s = get_slot(fd);
+        s.write = nullptr;
+        s.edge = false;
+        s.dropped = false;
+        s.mask = EPOLLIN;
+    }
+
+    slot& s = get_slot(fd);
+    s.kind = Kind::TIMER;
+    s.ident = ident;
+    s.read = hand;
+    s.period = data;
+    mark_changed(fd, s);
+}
+
+void epoll_backend::remove_timer(size_t ident) {
+    auto it = timers.find(ident);
+    if (it == timers.end()) {
+        return;
+    }
+    // timer is disarmed on flush, unless it's added again before
+    slot& s = slots[it->second];
+    s.read = nullptr;
+    mark_changed(it->second, s);
+}
+
+void epoll_backend::add_signal(size_t ident, handler* hand) {
+    auto it = signals.find(ident);
+    if (it != signals.end()) {
+        slots[it->second].read = hand;
+        return;
+    }
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, static_cast<int>(ident));
+    // signal has to be blocked to be delivered through signalfd
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd == -1) {
+        throw_error("signalfd fails: ");
+    }
+
+    struct epoll_event temp_event;
+    temp_event.events = EPOLLIN;
+    temp_event.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &temp_event) == -1) {
+        close(fd);
+        throw_error("epoll_ctl fails: ");
+    }
+    signals[ident] = fd;
+
+    slot& s = get_slot(fd);
+    s.kind = Kind::SIGNAL;
+    s.ident = ident;
+    s.read = hand;
+    s.mask = EPOLLIN;
+}
+
+void epoll_backend::remove_signal(size_t ident) {
+    auto it = signals.find(ident);
+    if (it == signals.end()) {
+        return;
+    }
+    int fd = it->second;
+    signals.erase(it);
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    slots[fd] = slot();
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, static_cast<int>(ident));
+    pthread_sigmask(SIG_UNBLOCK, &mask, nullptr);
+}
+
+int epoll_backend::wait(queue_event* events, int max_events, int timeout) {
+    flush();
+
+    // one descriptor could produce both read and write events
+    int amount = epoll_wait(epfd, evlist, std::min(max_events / 2, EVENTS_AMOUNT), timeout);
+    if (amount == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        throw_error("epoll_wait fails: ");
+    }
+
+    int result = 0;
+    for (int i = 0; i < amount; i++) {
+        int fd = evlist[i].data.fd;
+        uint32_t fired = evlist[i].events;
+        slot& s = slots[fd];
+
+        switch (s.kind) {
+            case Kind::SOCKET: {
+                uint16_t flags = 0;
+                intptr_t data = 0;
+                if (fired & EPOLLERR) {
+                    flags |= FLAG_ERROR;
+                }
+                if (fired & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) {
+                    flags |= FLAG_EOF;
+                    // like kqueue: report how many bytes are still readable
+                    int available = 0;
+                    if (ioctl(fd, FIONREAD, &available) == 0) {
+                        data = available;
+                    }
+                }
+
+                if (s.read && (fired & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                    events[result++] = queue_event{s.ident, FILTER_READ, flags, data, s.read};
+                }
+                if (s.write && (fired & (EPOLLOUT | EPOLLHUP | EPOLLERR))) {
+                    uint16_t write_flags = flags;
+                    if (!(fired & (EPOLLHUP | EPOLLERR))) {
+                        // peer stopped only sending, we still could write
+                        write_flags &= ~FLAG_EOF;
+                    }
+                    events[result++] = queue_event{s.ident, FILTER_WRITE, write_flags, 0, s.write};
+                }
+                break;
+            }
+            case Kind::TIMER: {
+                uint64_t expirations = 0;
+                if (::read(fd, &expirations, sizeof(expirations)) != sizeof(expirations) || !s.read) {
+                    // disarmed after event was queued in kernel
+                    break;
+                }
+                events[result++] = queue_event{s.ident, FILTER_TIMER, 0, static_cast<intptr_t>(expirations), s.read};
+                break;
+            }
+            case Kind::SIGNAL: {
+                struct signalfd_siginfo info;
+                intptr_t deliveries = 0;
+                while (::read(fd, &info, sizeof(info)) == sizeof(info)) {
+                    deliveries++;
+                }
+                if (deliveries != 0 && s.read) {
+                    events[result++] = queue_event{s.ident, FILTER_SIGNAL, 0, deliveries, s.read};
+                }
+                break;
+            }
+            case Kind::NONE:
+                break;
+        }
+    }
+    return result;
+}
+
+#endif /* SIMPLE_PROXY_EPOLL */
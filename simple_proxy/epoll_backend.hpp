@@ -0,0 +1,91 @@
+//
+//  epoll_backend.hpp
+//  simple_proxy
+//
+
+#ifndef epoll_backend_hpp
+#define epoll_backend_hpp
+
+#include "event_backend.hpp"
+
+#ifdef SIMPLE_PROXY_EPOLL
+
+#include <sys/epoll.h>
+#include <vector>
+#include <unordered_map>
+
+/*
+ epoll works with file descriptors, not with (ident, filter) pairs like kqueue,
+ so read and write interest of one socket are merged into one registration.
+ Timers are implemented with timerfd and signals with signalfd.
+ Changes are not sent to kernel immediately: changed descriptors are collected
+ and flushed before next epoll_wait, so delete + add of the same descriptor
+ costs at most one epoll_ctl and timer refresh costs one timerfd_settime
+ */
+struct epoll_backend : event_backend {
+    epoll_backend();
+    ~epoll_backend();
+
+    void add(size_t ident, int16_t filter, uint16_t flags, intptr_t data, handler* hand) override;
+
+    void remove(size_t ident, int16_t filter) override;
+
+    int wait(queue_event* events, int max_events, int timeout) override;
+
+    const char* name() const override {
+        return "epoll";
+    }
+private:
+    static const int EVENTS_AMOUNT = 1024;
+
+    enum class Kind : uint8_t {NONE, SOCKET, TIMER, SIGNAL};
+
+    /*
+     state of one descriptor registered in epoll,
+     slots are indexed by descriptor
+     */
+    struct slot {
+        Kind kind = Kind::NONE;
+        size_t ident = 0;
+        handler* read = nullptr;
+        handler* write = nullptr;
+        bool edge = false;
+        uint32_t mask = 0; // mask which is currently in kernel
+        bool changed = false; // descriptor is in changed list
+        bool dropped = false; // all interest was removed since last flush
+        intptr_t period = 0; // timers only, in milliseconds
+    };
+
+    int epfd;
+    struct epoll_event evlist[EVENTS_AMOUNT];
+    std::vector<slot> slots;
+
+    // timer ident -> timerfd
+    std::unordered_map<size_t, int> timers;
+    // disarmed timerfds, still registered in epoll
+    std::vector<int> free_timers;
+    // descriptors which have to be synchronized with kernel before next wait
+    std::vector<int> changed;
+    // signal number -> signalfd
+    std::unordered_map<size_t, int> signals;
+
+    slot& get_slot(int fd);
+
+    void mark_changed(int fd, slot& s);
+
+    void flush();
+
+    void apply(int fd, slot& s);
+
+    void apply_timer(int fd, slot& s);
+
+    void add_timer(size_t ident, intptr_t data, handler* hand);
+    void remove_timer(size_t ident);
+
+    void add_signal(size_t ident, handler* hand);
+    void remove_signal(size_t ident);
+};
+
+#endif /* SIMPLE_PROXY_EPOLL */
+
+#endif /* epoll_backend_hpp */
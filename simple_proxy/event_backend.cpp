@@ -0,0 +1,34 @@
+//
+//  event_backend.cpp
+//  simple_proxy
+//
+
+#include <iostream>
+#include "event_backend.hpp"
+#include "epoll_backend.hpp"
+#include "io_uring_backend.hpp"
+#include "kqueue_backend.hpp"
+
+std::unique_ptr<event_backend> make_default_backend() {
+#ifdef SIMPLE_PROXY_EPOLL
+    return std::unique_ptr<event_backend>(new epoll_backend());
+#else
+    return std::unique_ptr<event_backend>(new kqueue_backend());
+#endif
+}
+
+std::unique_ptr<event_backend> make_backend(std::string const& name) {
+    if (name == "io_uring") {
+#ifdef SIMPLE_PROXY_IO_URING
+        try {
+            return std::unique_ptr<event_backend>(new io_uring_backend());
+        } catch (std::exception const& e) {
+            // kernel without io_uring or it is forbidden
+            std::cerr << e.what() << ", falling back to readiness polling" << std::endl;
+        }
+#else
+        std::cerr << "io_uring is not supported, falling back to readiness polling" << std::endl;
+#endif
+    }
+    return make_default_backend();
+}
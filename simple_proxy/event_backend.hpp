@@ -0,0 +1,96 @@
+//
+//  event_backend.hpp
+//  simple_proxy
+//
+
+#ifndef event_backend_hpp
+#define event_backend_hpp
+
+#include <stdio.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+
+#if defined(__linux__)
+#define SIMPLE_PROXY_EPOLL 1
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define SIMPLE_PROXY_IO_URING 1
+#endif
+#endif
+#else
+#define SIMPLE_PROXY_KQUEUE 1
+#endif
+
+struct queue_event;
+
+using handler = std::function<void(queue_event&)>;
+
+/*
+ filters are the same for every backend,
+ each backend translates them to it's own representation
+ */
+enum event_filter : int16_t {
+    FILTER_READ,
+    FILTER_WRITE,
+    FILTER_TIMER,  // ident - any id, data - period in milliseconds
+    FILTER_SIGNAL  // ident - signal number
+};
+
+enum event_flag : uint16_t {
+    // reported by backend
+    FLAG_EOF = 1 << 0,
+    FLAG_ERROR = 1 << 1,
+    // requested on registration
+    FLAG_EDGE = 1 << 2
+};
+
+/*
+ event which was returned from backend
+ data is amount of bytes available for read/write if backend knows it,
+ amount of expirations for timers and amount of deliveries for signals
+ */
+struct queue_event {
+    size_t ident;
+    int16_t filter;
+    uint16_t flags;
+    intptr_t data;
+    handler* hand;
+};
+
+struct event_backend {
+    event_backend() {}
+    virtual ~event_backend() {}
+
+    event_backend(event_backend const&) = delete;
+    event_backend& operator=(event_backend const&) = delete;
+
+    /*
+     adding already added (ident, filter) pair replaces handler and parameters
+     */
+    virtual void add(size_t ident, int16_t filter, uint16_t flags, intptr_t data, handler* hand) = 0;
+
+    virtual void remove(size_t ident, int16_t filter) = 0;
+
+    /*
+     blocks until at least one event occurred or timeout (milliseconds, -1 is infinity) expired
+     returns amount of events written to events
+     */
+    virtual int wait(queue_event* events, int max_events, int timeout) = 0;
+
+    virtual const char* name() const = 0;
+};
+
+/*
+ epoll on linux, kqueue everywhere else
+ */
+std::unique_ptr<event_backend> make_default_backend();
+
+/*
+ backend by name ("io_uring", "epoll", "kqueue"),
+ falls back to default backend if requested one is unavailable
+ */
+std::unique_ptr<event_backend> make_backend(std::string const& name);
+
+#endif /* event_backend_hpp */
@@ -4,124 +4,94 @@
 
 #include <sys/socket.h>
 #include <assert.h>
+#include <unistd.h>
+#include <cstring>
+#include <fcntl.h>
 #include "event_queue.hpp"
 #include "custom_exception.hpp"
 
-background_tasks_handler::background_tasks_handler(): work(true) {
-    for (int i = 0; i < THREADS_AMOUNT; i++) {
-        // TODO: what will happen if constructor of std::thread fails
-        // or push_back fails?
-        threads.push_back(std::thread(
-                                      [this](){
-                                          execute();
-                                      }
-                          ));
-    }
-}
-
-
-background_tasks_handler::~background_tasks_handler() {
-    stop();
-}
-
+#ifdef SIMPLE_PROXY_EPOLL
+#include <sys/eventfd.h>
+#endif
 
-void background_tasks_handler::push(task t) {
-    std::unique_lock<std::mutex> lock(mutex);
-    poll.push(t);
-    
-    condition.notify_one();
-}
+event_queue::event_queue()
+    : event_queue(make_default_backend())
+{}
 
+const size_t event_queue::DEFAULT_BACKGROUND_THREADS;
 
-void background_tasks_handler::execute() {
-    while(work) {
-        std::unique_lock<std::mutex> lock(mutex);
-        
-        while (poll.size() == 0) {
-            condition.wait(lock);
-            if (!work) break;
-        }
-        
-        if (!work) return;
-        
-        //We've got one
-        task current = poll.front();
-        poll.pop();
-        
-        lock.unlock();
-        //execute
-        current();
+event_queue::event_queue(std::unique_ptr<event_backend> queue_backend, size_t min_background_threads, size_t max_background_threads)
+    : backend(std::move(queue_backend))
+    , background_tasks(min_background_threads, max_background_threads)
+{
+#ifdef SIMPLE_PROXY_EPOLL
+    wakeup_in = wakeup_out = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeup_in == -1) {
+        throw custom_exception("fail to create eventfd");
     }
-}
-
-void background_tasks_handler::stop() {
-    work = false;
-    condition.notify_all();
-    
-    for (int i = 0; i < THREADS_AMOUNT; i++)
-        if (threads[i].joinable())
-            threads[i].join();
-}
-
-
-event_queue::event_queue() {
-    kq = kqueue();
+#else
     int fds[2];
     if (pipe(fds) == -1) {
         throw custom_exception("fail to create pipe fd");
     }
-    pipe_in = fds[1];
-    pipe_out = fds[0];
+    wakeup_in = fds[1];
+    wakeup_out = fds[0];
+    fcntl(wakeup_out, F_SETFL, fcntl(wakeup_out, F_GETFL, 0) | O_NONBLOCK);
+#endif
     
     main_thread_events_handler = handler {
-        [this](struct kevent& event) {
-            assert(main_thread_tasks.size() != 0);
-            char buffer;
-            read(pipe_out, &buffer, sizeof(buffer));
+        [this](queue_event& event) {
+            // reset wakeup before taking tasks, so next push wakes up again
+            char buffer[64];
+            while (read(wakeup_out, buffer, sizeof(buffer)) > 0) {}
             
-            std::unique_lock<std::mutex> locker{mutex};
-            if (main_thread_tasks.size() != 0) {
-                auto f = main_thread_tasks.back();
-                main_thread_tasks.pop_back();
-                locker.unlock();
+            main_thread_tasks.consume_all([](task& f) {
                 f();
-            }
+            });
         }
     };
     
-    add_event(pipe_out, EVFILT_READ, &main_thread_events_handler);
+    add_event(wakeup_out, FILTER_READ, &main_thread_events_handler);
 }
 
 event_queue::~event_queue() {
-    close(pipe_in);
-    close(pipe_out);
+    close(wakeup_out);
+    if (wakeup_in != wakeup_out) {
+        close(wakeup_in);
+    }
 }
 
 
 void event_queue::delete_event(size_t ident, int16_t filter) {
-    event(ident, filter, EV_DELETE, 0, 0, nullptr);
+    backend->remove(ident, filter);
+    
+    if (deleted_events.find(std::make_pair(ident, filter)) == deleted_events.end()) {
+        deleted_events.insert(std::make_pair(ident, filter));
+    }
 }
 
 
-void event_queue::add_event(size_t ident, int16_t filter, handler* hand) {
-    event(ident, filter, EV_ADD, 0, 0, hand);
+void event_queue::add_event(size_t ident, int16_t filter, handler* hand, uint16_t flags, intptr_t data) {
+    backend->add(ident, filter, flags, data, hand);
 }
 
 
 void event_queue::execute_in_main(task t) {
-    std::lock_guard<std::mutex> locker{mutex};
-    main_thread_tasks.push_back(t);
-    write(pipe_in, "T", 1);
+    if (main_thread_tasks.push(std::move(t))) {
+        // eventfd requires 8 bytes, pipe takes any
+        uint64_t value = 1;
+        write(wakeup_in, &value, sizeof(value));
+    }
 }
 
 
-void event_queue::execute_in_background(task t) {
-    background_tasks.push(t);
+void event_queue::execute_in_background(background_task t) {
+    background_tasks.push(std::move(t));
 }
 
 
 int event_queue::occurred() {
-    return kevent(kq, NULL, 0, evlist, SOMAXCONN, NULL);
+    return backend->wait(evlist, EVENTS_AMOUNT, timers.next_timeout());
 }
 
 
@@ -134,10 +104,11 @@ void event_queue::execute(int amount) {
 //        std::cerr << "EVENT " << evlist[i].filter << ' ' << evlist[i].ident << "\n";
         
         if (deleted_events.size() == 0 || deleted_events.find(std::make_pair(evlist[i].ident, evlist[i].filter)) == deleted_events.end()) {
-            handler* hand = static_cast<handler*>(evlist[i].udata);
-            (*hand)(evlist[i]);
+            (*evlist[i].hand)(evlist[i]);
         }
     }
+    
+    timers.advance();
 }
 
 
@@ -145,19 +116,3 @@ void event_queue::stop_resolve() {
     background_tasks.stop();
 }
 
-
-void event_queue::event(size_t ident, int16_t filter, uint16_t flags, uint32_t fflags, int64_t data, handler* hand) {
-    struct kevent temp_event;
-    
-    EV_SET(&temp_event, ident, filter, flags, fflags, data, static_cast<void*>(hand));
-
-    if (kevent(kq, &temp_event, 1, NULL, 0, NULL) == -1) {
-        std::string message{"kevent fails: "};
-        message.append(std::strerror(errno));
-        throw custom_exception(message);
-    }
-    
-    if ((flags & EV_DELETE) && (deleted_events.find(std::make_pair(ident, filter)) == deleted_events.end())) {
-            deleted_events.insert(std::make_pair(ident, filter));
-    }
-}
@@ -16,87 +16,91 @@
 #include <sys/socket.h>
 #include <functional>
 #include <sys/types.h>
-#include <sys/event.h>
 #include <sys/time.h>
 #include <set>
 #include <map>
 #include <array>
 #include <thread>
 #include <queue>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
 
-using handler = std::function<void(struct kevent&)>;
-using task = std::function<void()>;
-
-struct background_tasks_handler {
-    background_tasks_handler(background_tasks_handler const&) = delete;
-    background_tasks_handler& operator=(background_tasks_handler const&) = delete;
-    
-    background_tasks_handler(background_tasks_handler&&) = default;
-    background_tasks_handler& operator=(background_tasks_handler&&) = default;
+#include "event_backend.hpp"
+#include "mpsc_queue.hpp"
+#include "thread_pool.hpp"
+#include "timing_wheel.hpp"
 
-    background_tasks_handler();
-    ~background_tasks_handler();
-    
-    void push(task t);
-    
-    void stop();
-    
-private:
-    static const size_t THREADS_AMOUNT = 4;
-    
-    void execute();
-    
-    std::queue<task> poll;
-    std::condition_variable condition;
-    std::mutex mutex;
-    bool work; // TODO: std::atomic<bool>
-    std::vector<std::thread> threads;
-};
+using task = std::function<void()>;
 
 struct event_queue {
 public:
+    static const size_t DEFAULT_BACKGROUND_THREADS = 4;
+    
     event_queue();
     
+    event_queue(std::unique_ptr<event_backend> backend, size_t min_background_threads = DEFAULT_BACKGROUND_THREADS, size_t max_background_threads = 4 * DEFAULT_BACKGROUND_THREADS);
+    
     ~event_queue();
 
     void delete_event(size_t ident, int16_t filter);
 
-    void add_event(size_t ident, int16_t filter, handler* hand);
+    void add_event(size_t ident, int16_t filter, handler* hand, uint16_t flags = 0, intptr_t data = 0);
     
-    void event(size_t ident, int16_t filter, uint16_t flags, uint32_t fflags, int64_t data, handler* hand);
+    /*
+     ident for timer which isn't bound to any descriptor,
+     negative as int, so it never clashes with descriptors
+     */
+    int make_timer_ident() {
+        return next_timer_ident--;
+    }
+    
+    // deadlines checked between polls, cheaper than kernel timers for often moved ones
+    timing_wheel* get_timers() {
+        return &timers;
+    }
     
     void execute_in_main(task t);
     
-    void execute_in_background(task t);
+    void execute_in_background(background_task t);
     
+    // waits for events, but not longer than until the nearest deadline
     int occurred();
 
+    // handles events, then expired deadlines
     void execute(int amount);
     
     void stop_resolve();
+    
+    thread_pool::statistics get_background_statistics() const {
+        return background_tasks.get_statistics();
+    }
+    
+    const char* backend_name() const {
+        return backend->name();
+    }
 private:
-    struct kevent evlist[1024];
-    int kq;
-    int pipe_in;
-    int pipe_out;
+    static const int EVENTS_AMOUNT = 1024;
+    
+    std::unique_ptr<event_backend> backend;
+    queue_event evlist[EVENTS_AMOUNT];
+    /*
+     main thread is woken up through eventfd (pipe if there is no eventfd),
+     only when first task is pushed to empty queue
+     */
+    int wakeup_in;
+    int wakeup_out;
 
-    std::mutex mutex;
     std::set< std::pair<size_t, int16_t> > deleted_events;
     
-    handler main_thread_events_handler;
-    std::vector<task> main_thread_tasks;
-    background_tasks_handler background_tasks;
+    // -1 is reserved for invalid event_registration
+    int next_timer_ident = -2;
     
-    inline size_t event_type(int16_t filter) const {
-        switch (filter) {
-            case EVFILT_READ:
-                return 0;
-            case EVFILT_WRITE:
-                return 1;
-            default:
-                throw std::exception();
-        }
-    }
+    timing_wheel timers;
+    
+    handler main_thread_events_handler;
+    mpsc_queue<task> main_thread_tasks;
+    thread_pool background_tasks;
 };
 
 #endif /* event_queue_hpp */
@@ -11,15 +11,15 @@ event_registration::event_registration(event_queue* queue, int ident, int16_t fi
     : queue(queue), ident(ident), filter(filter), handler_(std::move(h)), is_listened(listen)
 {
     if (is_listened) {
-        queue->event(static_cast<size_t>(ident), filter, EV_ADD | flags, fflags , data, &handler_);
+        queue->add_event(static_cast<size_t>(ident), filter, &handler_, flags, data);
     }
 }
 
-event_registration::event_registration(event_queue* queue, int ident, int16_t filter, uint16_t flags, uint32_t fflags, intptr_t data, handler h, bool listen)
-    : queue(queue), ident(ident), filter(filter), flags(flags), fflags(fflags), data(data), handler_(std::move(h)), is_listened(listen)
+event_registration::event_registration(event_queue* queue, int ident, int16_t filter, uint16_t flags, intptr_t data, handler h, bool listen)
+    : queue(queue), ident(ident), filter(filter), flags(flags), data(data), handler_(std::move(h)), is_listened(listen)
 {
     if (is_listened) {
-        queue->event(static_cast<size_t>(ident), filter, EV_ADD | flags, fflags , data, &handler_);
+        queue->add_event(static_cast<size_t>(ident), filter, &handler_, flags, data);
     }
 }
 
@@ -29,7 +29,6 @@ event_registration::event_registration(event_registration&& other)
     ident = other.ident;
     filter = other.filter;
     flags = other.flags;
-    fflags = other.fflags;
     data = other.data;
     handler_ = std::move(other.handler_);
     is_listened = false;
@@ -53,7 +52,6 @@ event_registration& event_registration::operator=(event_registration&& other)
     ident = other.ident;
     filter = other.filter;
     flags = other.flags;
-    fflags = other.fflags;
     data = other.data;
     handler_ = std::move(other.handler_);
     is_listened = false;
@@ -72,9 +70,9 @@ event_registration& event_registration::operator=(event_registration&& other)
 
 
 void event_registration::change_function(handler &&hand) {
+    /*
+     kernel keeps pointer to handler_, not the handler itself,
+     so replacing it doesn't require any re-registration
+     */
     handler_ = std::move(hand);
-    bool temp = is_listened;
-    stop_listen();
-    if (temp && is_valid())
-        resume_listen();
 }
\ No newline at end of file
@@ -13,7 +13,7 @@ struct event_registration
 
     event_registration(event_queue* queue, int ident, int16_t filter, handler h, bool listen=false);
     
-    event_registration(event_queue* queue, int ident, int16_t filter, uint16_t flags, uint32_t fflags, intptr_t data, handler h, bool listen=false);
+    event_registration(event_queue* queue, int ident, int16_t filter, uint16_t flags, intptr_t data, handler h, bool listen=false);
 
     event_registration(event_registration const&) = delete;
     event_registration& operator=(event_registration const&) = delete;
@@ -27,14 +27,14 @@ struct event_registration
 
     inline void stop_listen() {
         if (is_listened && is_valid()) {
-            queue->event(static_cast<size_t>(ident), filter, EV_DELETE | flags, fflags, data, &handler_);
+            queue->delete_event(static_cast<size_t>(ident), filter);
             is_listened = false;
         }
     }
 
     inline void resume_listen() {
         if (!is_listened && is_valid()) {
-            queue->event(static_cast<size_t>(ident), filter, EV_ADD | flags, fflags, data, &handler_);
+            queue->add_event(static_cast<size_t>(ident), filter, &handler_, flags, data);
             is_listened = true;
         }
     }
@@ -61,7 +61,6 @@ private:
     int ident = -1;
     int16_t filter = 0;
     uint16_t flags = 0;
-    uint32_t fflags = 0;
     intptr_t data = 0;
 
     bool is_listened = false;
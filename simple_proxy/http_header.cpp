@@ -8,108 +8,249 @@
 
 #include "http_header.hpp"
 #include "custom_exception.hpp"
+#include "byte_scan.hpp"
 #include <assert.h>
+#include <unistd.h>
+#include <cstring>
+#include <cctype>
 #include <iostream>
 
-void http_header::append(std::string const& chunk) {
-    static const std::string header_end{"\r\n\r\n"};
+// names of http_header::Field in the same order
+static const string_ref FIELD_NAMES[] = {
+    "Host", "Connection", "Content-Length", "Transfer-Encoding", "ETag", "Cache-Control",
+    "If-Match", "If-Modified-Since", "If-None-Match", "If-Range", "If-Unmodified-Since"
+};
+
+void http_header::append(const char* chunk, size_t size) {
+    if (state == State::COMPLETE) {
+        extra.append(chunk, size);
+        return;
+    }
     
-    data += chunk;
+    data.append(chunk, size);
+    parse();
     
-    if (data.find(header_end) != std::string::npos) {
+    if (parser == Parser::HEADER_END) {
+        //everything after empty line belongs to body
+        extra = data.substr(parsed);
+        data.resize(parsed);
         state = State::READED;
         init_properties();
     }
 }
 
+void http_header::parse() {
+    const char* end = data.data() + data.size();
+    for (; parsed < data.size() && parser != Parser::HEADER_END; parsed++) {
+        //inside of lines bytes without meaning are skipped by blocks
+        const char* from = data.data() + parsed;
+        if (parser == Parser::FIRST_LINE) {
+            parsed = scan_for(from, end, ' ', '\n') - data.data();
+        } else if (parser == Parser::NAME) {
+            parsed = scan_for(from, end, ':', '\n') - data.data();
+        } else if (parser == Parser::VALUE) {
+            parsed = scan_for(from, end, '\n') - data.data();
+        }
+        if (parsed == data.size()) {
+            break;
+        }
+        
+        char c = data[parsed];
+        switch (parser) {
+            case Parser::FIRST_LINE:
+                if (c == '\n') {
+                    first_line_end = parsed > 0 && data[parsed - 1] == '\r' ? parsed - 1 : parsed;
+                    if (target_begin != 0 && target_end == 0) {
+                        target_end = first_line_end;
+                    }
+                    parser = Parser::FIELD_START;
+                } else if (c == ' ') {
+                    if (target_begin == 0) {
+                        target_begin = parsed + 1;
+                    } else if (target_begin == parsed) {
+                        //several spaces before target
+                        target_begin++;
+                    } else if (target_end == 0) {
+                        target_end = parsed;
+                    }
+                }
+                break;
+            case Parser::FIELD_START:
+                if (c == '\r') {
+                    parser = Parser::LINE_END;
+                } else if (c == '\n') {
+                    parser = Parser::HEADER_END;
+                } else {
+                    current.name_begin = parsed;
+                    parser = Parser::NAME;
+                }
+                break;
+            case Parser::LINE_END:
+                if (c == '\n') {
+                    parser = Parser::HEADER_END;
+                } else {
+                    //stray \r, treat it as beginning of field
+                    current.name_begin = parsed - 1;
+                    parser = Parser::NAME;
+                }
+                break;
+            case Parser::NAME:
+                if (c == ':') {
+                    current.name_end = parsed;
+                    parser = Parser::VALUE_START;
+                } else if (c == '\n') {
+                    //line without colon is ignored
+                    parser = Parser::FIELD_START;
+                }
+                break;
+            case Parser::VALUE_START:
+                if (c == ' ' || c == '\t') {
+                    break;
+                }
+                current.value_begin = parsed;
+                parser = Parser::VALUE;
+                if (c != '\n') {
+                    break;
+                }
+                //empty value, line ends right here
+                // fall through
+            case Parser::VALUE:
+                if (c == '\n') {
+                    size_t end = parsed;
+                    while (end > current.value_begin && isspace(static_cast<unsigned char>(data[end - 1]))) {
+                        end--;
+                    }
+                    current.value_end = end;
+                    add_field(current);
+                    parser = Parser::FIELD_START;
+                }
+                break;
+            case Parser::HEADER_END:
+                break;
+        }
+    }
+}
+
 void http_header::init_properties() {
-    static const std::string header_end{"\r\n\r\n"};
     type = Type::HEADER;
     
-    size_t pos = data.find("\r\n");
-    head = data.substr(0, pos);
-    
     transform_to_relative();
-    parse_is_chunked_encoding();
-    parse_content_length();
-
-    sz = data.find(header_end) + header_end.size();
+    
+    const field* length = find_field(Field::CONTENT_LENGTH);
+    if (has_token(Field::TRANSFER_ENCODING, "chunked")) {
+        //length is ignored for chunked body
+        type = Type::CHUNKED;
+    } else if (length) {
+        type = Type::CONTENT;
+        content_length = 0;
+        for (size_t pos = length->value_begin; pos < length->value_end && isdigit(static_cast<unsigned char>(data[pos])); pos++) {
+            content_length *= 10;
+            content_length += (data[pos] - '0');
+        }
+    }
 
     state = State::COMPLETE;
 }
 
-void http_header::parse_content_length() {
-    static const std::string content_mark{"Content-Length:"};
-    
-    size_t pos = data.find(content_mark);
-    if (pos == std::string::npos) {
-        return;
+void http_header::add_field(field const& line) {
+    fields.push_back(line);
+    index_field(fields.size() - 1);
+}
+
+void http_header::index_field(size_t index) {
+    field const& line = fields[index];
+    string_ref name(data.data() + line.name_begin, line.name_end - line.name_begin);
+    for (size_t i = 0; i < known.size(); i++) {
+        if (known[i] == -1 && name.equals_ignore_case(FIELD_NAMES[i])) {
+            known[i] = static_cast<int>(index);
+            break;
+        }
     }
-    
-    assert(type != Type::CHUNKED);
-    
-    type = Type::CONTENT;
-    
-    content_length = 0;
-    pos += content_mark.size();
-    while (data[pos] == ' ') pos++;
-    
-    while (isdigit(data[pos])) {
-        content_length *= 10;
-        content_length += (data[pos] - '0');
-        pos++;
+}
+
+const http_header::field* http_header::find_field(Field name) const {
+    int index = known[static_cast<size_t>(name)];
+    return index == -1 ? nullptr : &fields[index];
+}
+
+const http_header::field* http_header::find_field(string_ref name) const {
+    for (field const& line: fields) {
+        if (name.equals_ignore_case(string_ref(data.data() + line.name_begin, line.name_end - line.name_begin))) {
+            return &line;
+        }
     }
+    return nullptr;
 }
 
-void http_header::parse_is_chunked_encoding() {
-    static const std::string chunked_encoding_mark{"chunked"};
-    
-    if (data.find(chunked_encoding_mark) != std::string::npos) {
-        type = Type::CHUNKED;
+string_ref http_header::get_value(field const& line) const {
+    return string_ref(data.data() + line.value_begin, line.value_end - line.value_begin);
+}
+
+bool http_header::has_field(string_ref name) const {
+    return find_field(name) != nullptr;
+}
+
+string_ref http_header::get_field(Field field) const {
+    const struct field* line = find_field(field);
+    return line == nullptr ? string_ref() : get_value(*line);
+}
+
+string_ref http_header::get_field(string_ref name) const {
+    const field* line = find_field(name);
+    return line == nullptr ? string_ref() : get_value(*line);
+}
+
+bool http_header::has_token(Field field, string_ref token) const {
+    string_ref value = get_field(field);
+    size_t pos = 0;
+    while (pos < value.size()) {
+        size_t end = pos;
+        while (end < value.size() && value[end] != ',') {
+            end++;
+        }
+        size_t next = end + 1;
+        while (pos < end && isspace(static_cast<unsigned char>(value[pos]))) {
+            pos++;
+        }
+        while (end > pos && isspace(static_cast<unsigned char>(value[end - 1]))) {
+            end--;
+        }
+        if (value.substr(pos, end - pos).equals_ignore_case(token)) {
+            return true;
+        }
+        pos = next;
     }
+    return false;
 }
 
 std::string http_header::retrieve_host() const {
-    static const std::string host_mark("\r\nHost:");
-    
-    size_t pos = data.find(std::string(host_mark));
-    if (pos == std::string::npos) {
+    const field* host = find_field(Field::HOST);
+    if (host == nullptr) {
         return std::string("localhost");
     }
     
-    std::string host;
-    pos += host_mark.size();
-    while (data[pos] == ' ') pos++;
-    
-    while (data[pos] != '\n' && data[pos] != '\r' && data[pos] != ':' && data[pos] != ' ') {
-        host += data[pos++];
+    size_t end = host->value_begin;
+    while (end < host->value_end && data[end] != ':' && data[end] != ' ') {
+        end++;
     }
-    
-    return host;
+    return data.substr(host->value_begin, end - host->value_begin);
 }
 
 
 size_t http_header::retrieve_port() const {
-    static const std::string host_mark("\r\nHost:");
-    
-    size_t pos = data.find(host_mark);
-    if (pos == std::string::npos) {
+    const field* host = find_field(Field::HOST);
+    if (host == nullptr) {
         return 80;
     }
     
-    pos += host_mark.size();
-    while (data[pos] == ' ') pos++;
-    
-    while (data[pos] != '\n' && data[pos] != '\r' && data[pos] != ':') {
-        pos++;
-    }
-    
-    if (data[pos] != ':')
+    size_t pos = data.find(':', host->value_begin);
+    if (pos == std::string::npos || pos >= host->value_end) {
         return 80;
+    }
     pos++;
     
     size_t port = 0;
-    while (isdigit(data[pos])) {
+    while (pos < host->value_end && isdigit(static_cast<unsigned char>(data[pos]))) {
         port *= 10;
         port += (data[pos] - '0');
         pos++;
@@ -120,106 +261,108 @@ size_t http_header::retrieve_port() const {
 
 
 void http_header::transform_to_relative() {
-    size_t pos = 0;
-    //skip POST or GET
-    while (data[pos] != ' ') pos++;
-    pos++;
-    
-    if (data[pos] == '/')
+    if (target_begin == target_end || data[target_begin] == '/') {
         //it's already relative
         return;
+    }
     
-    std::string host = retrieve_host();
-    if (host == "localhost") {
+    if (!has_field(Field::HOST)) {
         return;
     }
-//    std::cout << "DATA " << data << std::endl;
-    size_t host_pos = data.find(host);
-    size_t end = host_pos;
     
-    while (data[end] != '/') end++;
+    size_t scheme = data.find("://", target_begin);
+    if (scheme == std::string::npos || scheme >= target_end) {
+        return;
+    }
     
-    data = data.substr(0, pos) + data.substr(end);
+    //absolute target loses scheme and authority
+    size_t path = data.find('/', scheme + 3);
+    size_t removed;
+    if (path == std::string::npos || path >= target_end) {
+        removed = target_end - target_begin - 1;
+        data.replace(target_begin, target_end - target_begin, "/");
+    } else {
+        removed = path - target_begin;
+        data.erase(target_begin, removed);
+    }
+    
+    target_end -= removed;
+    first_line_end -= removed;
+    parsed -= removed;
+    for (field& line: fields) {
+        line.name_begin -= removed;
+        line.name_end -= removed;
+        line.value_begin -= removed;
+        line.value_end -= removed;
+    }
 }
 
 
-std::string http_header::get_field(std::string const& field) const {
-    size_t pos = data.find(field);
-    if (pos == std::string::npos) {
-        return "";
+bool http_header::is_keep_alive() const {
+    if (find_in_head("HTTP/1.0")) {
+        return has_token(Field::CONNECTION, "keep-alive");
     }
-    pos = pos + field.size() + 1; //skip :
-    
-    while (data[pos] == ' ') pos++;
-    
-    std::string result{};
-    while (data[pos] != ' ' && data[pos] != '\n' && data[pos] != '\r' && data[pos] != ',') {
-        result += data[pos];
-        pos++;
+    return !has_token(Field::CONNECTION, "close");
+}
+
+int http_header::get_status() const {
+    if (data.compare(0, 5, "HTTP/") != 0 || target_end - target_begin != 3) {
+        return 0;
     }
-    return result;
+    int status = 0;
+    for (size_t pos = target_begin; pos < target_end; pos++) {
+        if (!isdigit(static_cast<unsigned char>(data[pos]))) {
+            return 0;
+        }
+        status = status * 10 + (data[pos] - '0');
+    }
+    return status;
 }
 
 std::string http_header::get_url() const {
-    size_t pos = data.find(' ');
-    while (data[pos] == ' ') pos++;
-    
-    std::string result{retrieve_host()};
-    while (data[pos] != ' ') {
-        result += data[pos];
-        pos++;
-    }
-    return result;
+    return retrieve_host() + data.substr(target_begin, target_end - target_begin);
 }
 
 
 void http_header::add_line(std::string const& key, std::string const value) {
-    data.substr(0, data.size() - 2) + key + ": " + value + "\n" + data.substr(data.size() - 2);
-}
-
-std::string  http_header::get_ip_by_host(std::string const& host, size_t port) {
-    struct addrinfo hints, *res, *res0;
-    int error;
-    int s;
+    if (state != State::COMPLETE) {
+        return;
+    }
     
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = PF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-        
-    error = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res0);
+    //new line goes right before the empty one
+    size_t pos = data.size() - (data.size() >= 2 && data[data.size() - 2] == '\r' ? 2 : 1);
+    std::string line = key + ": " + value + "\r\n";
+    data.insert(pos, line);
     
-    if (error) {
-        std::string message{"getaddrinfo failed: "};
-        message.append(std::strerror(error));
-        throw custom_exception{message};
+    add_field(field{pos, pos + key.size(), pos + key.size() + 2, pos + line.size() - 2});
+    parsed += line.size();
+}
+
+void http_header::remove_field(Field name) {
+    int index = known[static_cast<size_t>(name)];
+    if (index == -1) {
+        return;
     }
     
-    s = -1;
-    for (res = res0; res; res = res->ai_next) {
-        s = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-        if (s < 0) {
-            continue;
-        }
-        
-        if (connect(s, res->ai_addr, res->ai_addrlen) < 0) {
-            close(s);
-            s = -1;
-            continue;
+    //whole line with it's line feed
+    size_t begin = fields[index].name_begin;
+    size_t end = data.find('\n', fields[index].value_end) + 1;
+    size_t removed = end - begin;
+    data.erase(begin, removed);
+    fields.erase(fields.begin() + index);
+    parsed -= removed;
+    
+    for (field& line: fields) {
+        if (line.name_begin > begin) {
+            line.name_begin -= removed;
+            line.name_end -= removed;
+            line.value_begin -= removed;
+            line.value_end -= removed;
         }
-        
-        break;  /* okay we got one */
-    }
-    if (s < 0) {
-        throw custom_exception{"fail to find valid ip"};
     }
     
-    if (res->ai_family == AF_INET) {
-        struct sockaddr_in  *sockaddr_ipv4;
-        sockaddr_ipv4 = (struct sockaddr_in *) res->ai_addr;
-        std::string ip = std::string(inet_ntoa(sockaddr_ipv4->sin_addr));
-        freeaddrinfo(res0);
-        return ip;
-    } else {
-        throw custom_exception{"get ip by host failed: ai_family != AF_INET"};
+    known.fill(-1);
+    for (size_t i = 0; i < fields.size(); i++) {
+        index_field(i);
     }
 }
@@ -11,6 +11,9 @@
 
 #include <stdio.h>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <array>
 #include <sstream>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -19,11 +22,15 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include "string_ref.hpp"
 
 
 struct http_header {
     enum class State {READING, READED, COMPLETE};
     enum class Type {UNDEFINED, HEADER, CHUNKED, CONTENT};
+    // fields used by proxy, they are found without searching
+    enum class Field {HOST, CONNECTION, CONTENT_LENGTH, TRANSFER_ENCODING, ETAG, CACHE_CONTROL,
+                      IF_MATCH, IF_MODIFIED_SINCE, IF_NONE_MATCH, IF_RANGE, IF_UNMODIFIED_SINCE, COUNT};
 
     http_header (http_header const&) = delete;
     http_header& operator=(http_header const&) = delete;
@@ -31,28 +38,41 @@ struct http_header {
     http_header (http_header&&) = default;
     http_header& operator=(http_header&&) = default;
     
-    http_header() {}
+    http_header() {
+        clear();
+    }
 
     http_header(std::string initial) {
+        clear();
         append(initial);
     }
     
-    void append(std::string const& chunk);
+    /*
+     parsing is resumed from the place where previous chunk ended,
+     every byte is scanned once. Bytes after header go to extra data
+     */
+    void append(const char* chunk, size_t size);
+    
+    void append(std::string const& chunk) {
+        append(chunk.data(), chunk.size());
+    }
 
     void clear() {
         data.clear();
+        extra.clear();
+        fields.clear();
+        known.fill(-1);
         type = Type::UNDEFINED;
         state = State::READING;
+        parser = Parser::FIRST_LINE;
+        parsed = 0;
         content_length = 0;
-        sz = 0;
+        first_line_end = 0;
+        target_begin = target_end = 0;
     }
 
     inline size_t size() const {
-        if (!(state == State::COMPLETE)) {
-             return data.size();
-        } else {
-            return sz;
-        }
+        return data.size();
     }
 
     inline Type get_type() const {
@@ -67,19 +87,45 @@ struct http_header {
         return content_length;
     }
 
-    inline std::string get_string_representation() const {
+    // header itself, without extra data
+    inline std::string const& get_string_representation() const {
         return data;
     }
     
-    inline bool has_field(std::string const& field) const {
-        return data.find(field) != std::string::npos;
+    // bytes which came after header, beginning of body
+    inline std::string const& get_extra_data() const {
+        return extra;
     }
     
+    inline bool has_field(Field field) const {
+        return known[static_cast<size_t>(field)] != -1;
+    }
+    
+    // case insensitive
+    bool has_field(string_ref name) const;
+    
     inline bool find_in_head(std::string const& temp) const {
-        return head.find(temp) != std::string::npos;
+        auto head_end = data.begin() + first_line_end;
+        return std::search(data.begin(), head_end, temp.begin(), temp.end()) != head_end;
     }
     
-    std::string get_field(std::string const& field) const;
+    // status code of responce, 0 if it's request or status line is malformed
+    int get_status() const;
+    
+    /*
+     value of field, empty if there is no such field.
+     Views are valid until header is changed
+     */
+    string_ref get_field(Field field) const;
+    
+    // case insensitive
+    string_ref get_field(string_ref name) const;
+    
+    // true if comma separated value of field contains token, case insensitive
+    bool has_token(Field field, string_ref token) const;
+    
+    // true if connection could be used for the next message after this one
+    bool is_keep_alive() const;
     
     std::string get_url() const;
     
@@ -89,19 +135,48 @@ struct http_header {
     
     void add_line(std::string const& key, std::string const value);
     
-    std::string static get_ip_by_host(std::string const& host, size_t port = 80);
+    // removes the first line with this field
+    void remove_field(Field field);
 private:
+    enum class Parser {FIRST_LINE, FIELD_START, NAME, VALUE_START, VALUE, LINE_END, HEADER_END};
+
+    // offsets of one header line inside data
+    struct field {
+        size_t name_begin;
+        size_t name_end;
+        size_t value_begin;
+        size_t value_end;
+    };
+
     std::string data;
-    std::string head;
+    std::string extra;
+    std::vector<field> fields;
+    // index in fields of the first line with known name, -1 if there is no such line
+    std::array<int, static_cast<size_t>(Field::COUNT)> known;
     Type type = Type::UNDEFINED;
     State state = State::READING;
     
+    Parser parser = Parser::FIRST_LINE;
+    // position in data where parsing continues
+    size_t parsed = 0;
+    field current;
+    
     size_t content_length = 0;
-    size_t sz = 0;
+    // request target (or status code) inside first line
+    size_t first_line_end = 0;
+    size_t target_begin = 0;
+    size_t target_end = 0;
+    
+    // returns nullptr if there is no such field
+    const field* find_field(string_ref name) const;
+    const field* find_field(Field name) const;
+    string_ref get_value(field const& line) const;
+    void add_field(field const& line);
+    // remembers position of known field
+    void index_field(size_t index);
     
+    void parse();
     void transform_to_relative();
-    void parse_content_length();
-    void parse_is_chunked_encoding();
     void init_properties();
 };
 
@@ -0,0 +1,94 @@
+//
+//  intrusive_list.hpp
+//  simple_proxy
+//
+
+#ifndef intrusive_list_hpp
+#define intrusive_list_hpp
+
+#include <stdio.h>
+#include <cstddef>
+#include <assert.h>
+
+/*
+ links of element in intrusive_list, element derives from it.
+ Element could be in one list at a time
+ */
+struct list_hook {
+    list_hook() {}
+
+    list_hook(list_hook const&) = delete;
+    list_hook& operator=(list_hook const&) = delete;
+
+    bool is_linked() const {
+        return owner != nullptr;
+    }
+
+private:
+    template<typename T>
+    friend struct intrusive_list;
+
+    list_hook* prev = nullptr;
+    list_hook* next = nullptr;
+    const void* owner = nullptr;
+};
+
+/*
+ doubly linked list of elements which keep links by themselves:
+ insertion and removal are O(1) and don't allocate.
+ List doesn't own elements
+ */
+template<typename T>
+struct intrusive_list {
+    intrusive_list() {
+        root.prev = root.next = &root;
+    }
+
+    intrusive_list(intrusive_list const&) = delete;
+    intrusive_list& operator=(intrusive_list const&) = delete;
+
+    void push_back(T* element) {
+        list_hook* hook = element;
+        assert(!hook->is_linked());
+        hook->prev = root.prev;
+        hook->next = &root;
+        root.prev->next = hook;
+        root.prev = hook;
+        hook->owner = this;
+        count++;
+    }
+
+    void erase(T* element) {
+        list_hook* hook = element;
+        assert(contains(element));
+        hook->prev->next = hook->next;
+        hook->next->prev = hook->prev;
+        hook->prev = hook->next = nullptr;
+        hook->owner = nullptr;
+        count--;
+    }
+
+    bool contains(T const* element) const {
+        const list_hook* hook = element;
+        return hook->owner == this;
+    }
+
+    T* front() const {
+        assert(count != 0);
+        return static_cast<T*>(root.next);
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+private:
+    list_hook root;
+    size_t count = 0;
+};
+
+#endif /* intrusive_list_hpp */
@@ -0,0 +1,355 @@
+//
+//  io_uring_backend.cpp
+//  simple_proxy
+//
+
+#include "io_uring_backend.hpp"
+
+#ifdef SIMPLE_PROXY_IO_URING
+
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/signalfd.h>
+#include "custom_exception.hpp"
+
+#ifndef POLLRDHUP
+#define POLLRDHUP 0x2000
+#endif
+
+const unsigned io_uring_backend::ENTRIES;
+const uint64_t io_uring_backend::WAIT_TIMEOUT_ID;
+
+static void throw_error(std::string message, int error) {
+    message.append(std::strerror(error));
+    throw custom_exception(message);
+}
+
+io_uring_backend::io_uring_backend() {
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+
+    ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, ENTRIES, &params));
+    if (ring_fd == -1) {
+        throw_error("io_uring_setup fails: ", errno);
+    }
+
+    sq_entries = params.sq_entries;
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        sq_size = cq_size = std::max(sq_size, cq_size);
+    }
+
+    sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        int error = errno;
+        close(ring_fd);
+        throw_error("io_uring mmap fails: ", error);
+    }
+
+    if (single_mmap) {
+        cq_ptr = sq_ptr;
+    } else {
+        cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {
+            int error = errno;
+            munmap(sq_ptr, sq_size);
+            close(ring_fd);
+            throw_error("io_uring mmap fails: ", error);
+        }
+    }
+
+    void* sqes_ptr = mmap(nullptr, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes_ptr == MAP_FAILED) {
+        int error = errno;
+        if (!single_mmap) {
+            munmap(cq_ptr, cq_size);
+        }
+        munmap(sq_ptr, sq_size);
+        close(ring_fd);
+        throw_error("io_uring mmap fails: ", error);
+    }
+
+    char* sq = static_cast<char*>(sq_ptr);
+    sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sqes = static_cast<struct io_uring_sqe*>(sqes_ptr);
+    local_tail = *sq_tail;
+
+    char* cq = static_cast<char*>(cq_ptr);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+}
+
+io_uring_backend::~io_uring_backend() {
+    for (auto& reg: registrations) {
+        if (reg.second.filter == FILTER_SIGNAL) {
+            close(reg.second.fd);
+        }
+    }
+    munmap(sqes, sq_entries * sizeof(struct io_uring_sqe));
+    if (cq_ptr != sq_ptr) {
+        munmap(cq_ptr, cq_size);
+    }
+    munmap(sq_ptr, sq_size);
+    close(ring_fd);
+}
+
+int io_uring_backend::enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+unsigned io_uring_backend::pending() const {
+    return local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+}
+
+struct io_uring_sqe* io_uring_backend::get_sqe() {
+    while (pending() == sq_entries) {
+        // ring is full, submit without waiting
+        __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+        if (enter(pending(), 0, 0) == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            throw_error("io_uring_enter fails: ", errno);
+        }
+    }
+
+    unsigned index = local_tail & sq_mask;
+    struct io_uring_sqe* sqe = &sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    local_tail++;
+    return sqe;
+}
+
+void io_uring_backend::arm(uint64_t reg_key, registration& reg) {
+    struct io_uring_sqe* sqe = get_sqe();
+    reg.id = ++last_id;
+    armed[reg.id] = reg_key;
+    sqe->user_data = reg.id;
+
+    switch (reg.filter) {
+        case FILTER_READ:
+        case FILTER_SIGNAL:
+        case FILTER_WRITE:
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = reg.fd;
+            sqe->poll32_events = (reg.filter == FILTER_WRITE) ? POLLOUT : (POLLIN | POLLRDHUP);
+            if (reg.edge) {
+                sqe->len = IORING_POLL_ADD_MULTI;
+            }
+            break;
+        case FILTER_TIMER:
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->fd = -1;
+            //freed when request completes (expired or cancelled)
+            sqe->addr = reinterpret_cast<uint64_t>(&(periods[reg.id] = reg.period));
+            sqe->len = 1;
+            break;
+    }
+}
+
+void io_uring_backend::cancel(registration& reg) {
+    if (reg.id == 0) {
+        return;
+    }
+    armed.erase(reg.id);
+
+    struct io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = (reg.filter == FILTER_TIMER) ? IORING_OP_TIMEOUT_REMOVE : IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = reg.id;
+    sqe->user_data = 0;
+    reg.id = 0;
+}
+
+void io_uring_backend::add(size_t ident, int16_t filter, uint16_t flags, intptr_t data, handler* hand) {
+    if (filter != FILTER_READ && filter != FILTER_WRITE && filter != FILTER_TIMER && filter != FILTER_SIGNAL) {
+        throw custom_exception("io_uring: unknown filter");
+    }
+
+    uint64_t reg_key = key(ident, filter);
+    auto it = registrations.find(reg_key);
+    if (it != registrations.end()) {
+        registration& reg = it->second;
+        reg.hand = hand;
+        if (filter == FILTER_TIMER) {
+            // restart timer with new period
+            cancel(reg);
+            reg.period.tv_sec = data / 1000;
+            reg.period.tv_nsec = (data % 1000) * 1000000;
+            arm(reg_key, reg);
+        } else if (reg.edge != ((flags & FLAG_EDGE) != 0)) {
+            cancel(reg);
+            reg.edge = !reg.edge;
+            arm(reg_key, reg);
+        }
+        return;
+    }
+
+    registration& reg = registrations[reg_key];
+    reg.ident = ident;
+    reg.filter = filter;
+    reg.edge = (flags & FLAG_EDGE) != 0;
+    reg.hand = hand;
+    reg.fd = static_cast<int>(ident);
+
+    if (filter == FILTER_TIMER) {
+        reg.period.tv_sec = data / 1000;
+        reg.period.tv_nsec = (data % 1000) * 1000000;
+    } else if (filter == FILTER_SIGNAL) {
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, static_cast<int>(ident));
+        // signal has to be blocked to be delivered through signalfd
+        pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+        reg.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (reg.fd == -1) {
+            int error = errno;
+            registrations.erase(reg_key);
+            throw_error("signalfd fails: ", error);
+        }
+    }
+
+    arm(reg_key, reg);
+}
+
+void io_uring_backend::remove(size_t ident, int16_t filter) {
+    auto it = registrations.find(key(ident, filter));
+    if (it == registrations.end()) {
+        return;
+    }
+
+    cancel(it->second);
+    if (filter == FILTER_SIGNAL) {
+        // armed poll keeps reference to the file, so descriptor could be closed now
+        close(it->second.fd);
+
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, static_cast<int>(ident));
+        pthread_sigmask(SIG_UNBLOCK, &mask, nullptr);
+    }
+    registrations.erase(it);
+}
+
+int io_uring_backend::wait(queue_event* events, int max_events, int timeout) {
+    for (uint64_t reg_key: rearm) {
+        auto it = registrations.find(reg_key);
+        if (it != registrations.end() && it->second.id == 0) {
+            arm(reg_key, it->second);
+        }
+    }
+    rearm.clear();
+    
+    if (timeout >= 0) {
+        //completes after timeout or together with the first other completion, so it never piles up
+        wait_limit.tv_sec = timeout / 1000;
+        wait_limit.tv_nsec = (timeout % 1000) * 1000000LL;
+        struct io_uring_sqe* sqe = get_sqe();
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast<uint64_t>(&wait_limit);
+        sqe->len = 1;
+        sqe->off = 1;
+        sqe->user_data = WAIT_TIMEOUT_ID;
+    }
+
+    // submit all changes and wait for completions with one syscall
+    __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+    if (enter(pending(), 1, IORING_ENTER_GETEVENTS) == -1) {
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            throw_error("io_uring_enter fails: ", errno);
+        }
+    }
+
+    int result = 0;
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail && result < max_events; head++) {
+        struct io_uring_cqe* cqe = &cqes[head & cq_mask];
+        if (cqe->user_data == 0 || cqe->user_data == WAIT_TIMEOUT_ID) {
+            // completion of cancel request or of waiting limit
+            continue;
+        }
+        periods.erase(cqe->user_data);
+
+        auto armed_it = armed.find(cqe->user_data);
+        if (armed_it == armed.end()) {
+            // request was cancelled
+            continue;
+        }
+        uint64_t reg_key = armed_it->second;
+        registration& reg = registrations[reg_key];
+
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            armed.erase(armed_it);
+            reg.id = 0;
+            rearm.push_back(reg_key);
+        }
+
+        queue_event& current = events[result];
+        current.ident = reg.ident;
+        current.filter = reg.filter;
+        current.flags = 0;
+        current.data = 0;
+        current.hand = reg.hand;
+
+        switch (reg.filter) {
+            case FILTER_TIMER:
+                if (cqe->res != -ETIME) {
+                    continue;
+                }
+                current.data = 1;
+                break;
+            case FILTER_SIGNAL: {
+                struct signalfd_siginfo info;
+                while (::read(reg.fd, &info, sizeof(info)) == sizeof(info)) {
+                    current.data++;
+                }
+                if (current.data == 0) {
+                    continue;
+                }
+                break;
+            }
+            default: {
+                if (cqe->res == -ECANCELED) {
+                    continue;
+                }
+                int revents = cqe->res < 0 ? POLLERR : cqe->res;
+                if (revents & POLLERR) {
+                    current.flags |= FLAG_ERROR;
+                }
+                bool eof = (reg.filter == FILTER_READ) ? (revents & (POLLHUP | POLLRDHUP | POLLERR)) : (revents & (POLLHUP | POLLERR));
+                if (eof) {
+                    current.flags |= FLAG_EOF;
+                    // like kqueue: report how many bytes are still readable
+                    int available = 0;
+                    if (reg.filter == FILTER_READ && ioctl(reg.fd, FIONREAD, &available) == 0) {
+                        current.data = available;
+                    }
+                }
+                break;
+            }
+        }
+        result++;
+    }
+
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    return result;
+}
+
+#endif /* SIMPLE_PROXY_IO_URING */
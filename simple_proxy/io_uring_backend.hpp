@@ -0,0 +1,107 @@
+//
+//  io_uring_backend.hpp
+//  simple_proxy
+//
+
+#ifndef io_uring_backend_hpp
+#define io_uring_backend_hpp
+
+#include "event_backend.hpp"
+
+#ifdef SIMPLE_PROXY_IO_URING
+
+#include <linux/io_uring.h>
+#include <vector>
+#include <unordered_map>
+
+/*
+ readiness backend on top of io_uring, it's poll backend and nothing more.
+ Every registration is a poll (or timeout) request in the ring,
+ all changes are submitted together with waiting in one io_uring_enter call.
+ Level-triggered registrations use oneshot polls which are re-armed before the next wait,
+ edge-triggered ones use multishot polls.
+ Sockets are still read and written by ordinary syscalls after readiness is reported,
+ there are no completion-based recv/send/accept/connect, so it isn't expected to be faster than epoll
+ */
+struct io_uring_backend : event_backend {
+    io_uring_backend();
+    ~io_uring_backend();
+
+    void add(size_t ident, int16_t filter, uint16_t flags, intptr_t data, handler* hand) override;
+
+    void remove(size_t ident, int16_t filter) override;
+
+    int wait(queue_event* events, int max_events, int timeout) override;
+
+    const char* name() const override {
+        return "io_uring poll";
+    }
+private:
+    static const unsigned ENTRIES = 1024;
+    // user_data of timeout which limits waiting
+    static const uint64_t WAIT_TIMEOUT_ID = ~uint64_t(0);
+
+    struct registration {
+        size_t ident = 0;
+        int16_t filter = 0;
+        bool edge = false;
+        handler* hand = nullptr;
+        int fd = -1;          // polled descriptor: socket or signalfd
+        uint64_t id = 0;      // user_data of armed request, 0 if not armed
+        struct __kernel_timespec period;
+    };
+
+    int ring_fd;
+
+    // submission ring
+    void* sq_ptr;
+    size_t sq_size;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned local_tail;
+
+    // completion ring
+    void* cq_ptr;
+    size_t cq_size;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+
+    uint64_t last_id = 0;
+    struct __kernel_timespec wait_limit;
+
+    // (ident, filter) -> registration
+    std::unordered_map<uint64_t, registration> registrations;
+    // user_data -> registration key
+    std::unordered_map<uint64_t, uint64_t> armed;
+    /*
+     user_data -> period of timeout request. It's owned by request, not by registration:
+     kernel reads it on submit, which could happen after registration is removed
+     */
+    std::unordered_map<uint64_t, struct __kernel_timespec> periods;
+    // oneshot requests which completed and have to be armed again
+    std::vector<uint64_t> rearm;
+
+    inline static uint64_t key(size_t ident, int16_t filter) {
+        return (static_cast<uint64_t>(ident) << 2) | static_cast<uint64_t>(filter);
+    }
+
+    struct io_uring_sqe* get_sqe();
+
+    unsigned pending() const;
+
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+
+    void arm(uint64_t reg_key, registration& reg);
+
+    void cancel(registration& reg);
+};
+
+#endif /* SIMPLE_PROXY_IO_URING */
+
+#endif /* io_uring_backend_hpp */
@@ -0,0 +1,132 @@
+//
+//  kqueue_backend.cpp
+//  simple_proxy
+//
+
+#include "kqueue_backend.hpp"
+
+#ifdef SIMPLE_PROXY_KQUEUE
+
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include "custom_exception.hpp"
+
+const int kqueue_backend::EVENTS_AMOUNT;
+const size_t kqueue_backend::MAX_CHANGES;
+
+kqueue_backend::kqueue_backend() {
+    kq = kqueue();
+    if (kq == -1) {
+        std::string message{"kqueue fails: "};
+        message.append(std::strerror(errno));
+        throw custom_exception(message);
+    }
+}
+
+kqueue_backend::~kqueue_backend() {
+    close(kq);
+}
+
+void kqueue_backend::add(size_t ident, int16_t filter, uint16_t flags, intptr_t data, handler* hand) {
+    struct kevent temp_event;
+    uint16_t native_flags = EV_ADD;
+    if (flags & FLAG_EDGE) {
+        native_flags |= EV_CLEAR;
+    }
+    // timers data is in milliseconds, which is default unit for kqueue
+    EV_SET(&temp_event, ident, to_native(filter), native_flags, 0, data, static_cast<void*>(hand));
+    change(temp_event);
+}
+
+void kqueue_backend::remove(size_t ident, int16_t filter) {
+    struct kevent temp_event;
+    EV_SET(&temp_event, ident, to_native(filter), EV_DELETE, 0, 0, nullptr);
+    change(temp_event);
+}
+
+void kqueue_backend::change(struct kevent const& event) {
+    uint64_t change_key = key(event.ident, from_native(event.filter));
+    auto it = pending.find(change_key);
+    if (it != pending.end()) {
+        /*
+         only the last change matters:
+         EV_ADD of existing event replaces it, so preceding delete is not needed
+         */
+        changelist[it->second] = event;
+        return;
+    }
+
+    if (changelist.size() == MAX_CHANGES) {
+        flush();
+    }
+    pending[change_key] = changelist.size();
+    changelist.push_back(event);
+}
+
+void kqueue_backend::flush() {
+    if (changelist.size() == 0) {
+        return;
+    }
+
+    /*
+     apply changes without draining pending events:
+     with EV_RECEIPT every change returns it's own result
+     */
+    for (auto& event: changelist) {
+        event.flags |= EV_RECEIPT;
+    }
+    std::vector<struct kevent> receipts(changelist.size());
+    struct timespec zero = {0, 0};
+    int amount = kevent(kq, changelist.data(), static_cast<int>(changelist.size()), receipts.data(), static_cast<int>(receipts.size()), &zero);
+    changelist.clear();
+    pending.clear();
+
+    if (amount == -1) {
+        std::string message{"kevent fails: "};
+        message.append(std::strerror(errno));
+        throw custom_exception(message);
+    }
+}
+
+int kqueue_backend::wait(queue_event* events, int max_events, int timeout) {
+    struct timespec limit;
+    limit.tv_sec = timeout / 1000;
+    limit.tv_nsec = (timeout % 1000) * 1000000L;
+    int amount = kevent(kq, changelist.data(), static_cast<int>(changelist.size()), evlist, std::min(max_events, EVENTS_AMOUNT), timeout < 0 ? NULL : &limit);
+    changelist.clear();
+    pending.clear();
+
+    if (amount == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        std::string message{"kevent fails: "};
+        message.append(std::strerror(errno));
+        throw custom_exception(message);
+    }
+
+    int result = 0;
+    for (int i = 0; i < amount; i++) {
+        if (evlist[i].flags & EV_ERROR) {
+            /*
+             failed change from changelist,
+             e.g. delete of descriptor which was already closed
+             */
+            continue;
+        }
+        queue_event& current = events[result++];
+        current.ident = evlist[i].ident;
+        current.filter = from_native(evlist[i].filter);
+        current.flags = 0;
+        if (evlist[i].flags & EV_EOF) {
+            current.flags |= FLAG_EOF;
+        }
+        current.data = evlist[i].data;
+        current.hand = static_cast<handler*>(evlist[i].udata);
+    }
+    return result;
+}
+
+#endif /* SIMPLE_PROXY_KQUEUE */
@@ -0,0 +1,87 @@
+//
+//  kqueue_backend.hpp
+//  simple_proxy
+//
+
+#ifndef kqueue_backend_hpp
+#define kqueue_backend_hpp
+
+#include "event_backend.hpp"
+
+#ifdef SIMPLE_PROXY_KQUEUE
+
+#include <sys/event.h>
+#include <sys/time.h>
+#include <stdexcept>
+#include <vector>
+#include <unordered_map>
+
+/*
+ changes are collected in changelist and passed to kernel
+ together with the next wait, as kqueue is meant to be used.
+ Only the last change of every (ident, filter) pair is kept
+ */
+struct kqueue_backend : event_backend {
+    kqueue_backend();
+    ~kqueue_backend();
+
+    void add(size_t ident, int16_t filter, uint16_t flags, intptr_t data, handler* hand) override;
+
+    void remove(size_t ident, int16_t filter) override;
+
+    int wait(queue_event* events, int max_events, int timeout) override;
+
+    const char* name() const override {
+        return "kqueue";
+    }
+private:
+    static const int EVENTS_AMOUNT = 1024;
+    static const size_t MAX_CHANGES = 1024;
+
+    struct kevent evlist[EVENTS_AMOUNT];
+    int kq;
+
+    std::vector<struct kevent> changelist;
+    // (ident, filter) -> position in changelist
+    std::unordered_map<uint64_t, size_t> pending;
+
+    void change(struct kevent const& event);
+
+    void flush();
+
+    inline static uint64_t key(size_t ident, int16_t filter) {
+        return (static_cast<uint64_t>(ident) << 2) | static_cast<uint64_t>(filter);
+    }
+
+    inline static int16_t to_native(int16_t filter) {
+        switch (filter) {
+            case FILTER_READ:
+                return EVFILT_READ;
+            case FILTER_WRITE:
+                return EVFILT_WRITE;
+            case FILTER_TIMER:
+                return EVFILT_TIMER;
+            case FILTER_SIGNAL:
+                return EVFILT_SIGNAL;
+            default:
+                throw std::exception();
+        }
+    }
+
+    inline static int16_t from_native(int16_t filter) {
+        switch (filter) {
+            case EVFILT_READ:
+                return FILTER_READ;
+            case EVFILT_WRITE:
+                return FILTER_WRITE;
+            case EVFILT_TIMER:
+                return FILTER_TIMER;
+            default:
+                return FILTER_SIGNAL;
+        }
+    }
+};
+
+#endif /* SIMPLE_PROXY_KQUEUE */
+
+#endif /* kqueue_backend_hpp */
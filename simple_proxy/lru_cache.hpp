@@ -10,62 +10,194 @@
 #define lru_cache_hpp
 
 #include <stdio.h>
-#include <map>
+#include <unordered_map>
 #include <list>
+#include <vector>
+#include <string>
+#include <memory>
 #include <mutex>
+#include <atomic>
 #include <thread>
+#include <functional>
+#include <algorithm>
 
+/*
+ weight of every entry is 1: capacity of cache is amount of entries
+ */
 template<typename K, typename V>
+struct entry_count {
+    size_t operator()(K const&, V const&) const {
+        return 1;
+    }
+};
+
+/*
+ weight of entry is memory it takes in lru_cache<std::string, std::string>:
+ key is kept both in LRU list and in index, value is behind shared_ptr,
+ plus list node, hash node, bucket and shared_ptr control block
+ */
+struct string_entry_size {
+    static size_t heap_size(std::string const& s) {
+        // short strings are stored inside std::string itself
+        return s.capacity() + 1 > sizeof(std::string) ? s.capacity() + 1 : 0;
+    }
+
+    size_t operator()(std::string const& key, std::string const& value) const {
+        return 2 * (sizeof(std::string) + heap_size(key))
+               + sizeof(std::string) + heap_size(value)
+               + 10 * sizeof(void*);
+    }
+};
+
+/*
+ thread-safe LRU cache split into independent shards by key hash,
+ so threads working with different keys rarely wait for each other.
+ Values are handed out as shared_ptr: entry evicted by another thread
+ stays alive while somebody uses it.
+ Capacity is measured in weights given by Weigher
+ */
+template<typename K, typename V, typename Weigher = entry_count<K, V>, typename Hash = std::hash<K>>
 struct lru_cache {
+public:
+    using value_ptr = std::shared_ptr<const V>;
 private:
-    std::list< std::pair<K, V> > lst;
-    std::map<K,decltype(lst.begin())> map;
-    size_t max_size = 1;
-    
-    mutable std::mutex mutex;
+
+    struct item {
+        K key;
+        value_ptr value;
+        size_t weight;
+    };
+
+    struct shard {
+        std::list<item> lst;
+        std::unordered_map<K, typename std::list<item>::iterator, Hash> map;
+        size_t weight = 0;
+        std::mutex mutex;
+    };
+
+    size_t shard_capacity = 1;
+    size_t max_weight = 1;
+    std::vector< std::unique_ptr<shard> > shards;
+    Hash hash;
+    Weigher weigher;
+
+    std::atomic<size_t> hits{0};
+    std::atomic<size_t> misses{0};
+
+    shard& shard_for(K const& key) {
+        size_t h = hash(key);
+        //map inside shard uses the same hash, so mix it before choosing
+        h ^= h >> 17;
+        h *= 0x9E3779B1u;
+        h ^= h >> 15;
+        return *shards[h % shards.size()];
+    }
+
+    // mutex of shard should be locked
+    void erase(shard& s, typename std::list<item>::iterator it) {
+        s.weight -= it->weight;
+        s.map.erase(it->key);
+        s.lst.erase(it);
+    }
 public:
-    lru_cache(size_t size): max_size(size) {}
-    
+    static const size_t DEFAULT_SHARDS = 16;
+
+    struct statistics {
+        size_t hits;
+        size_t misses;
+        size_t entries;
+        // sum of weights of all entries
+        size_t weight;
+    };
+
+    /*
+     entries heavier than max_entry_weight aren't cached,
+     0 means as much as one shard could hold
+     */
+    lru_cache(size_t capacity, size_t max_entry_weight = 0, size_t shards_amount = DEFAULT_SHARDS) {
+        if (shards_amount == 0) {
+            shards_amount = 1;
+        }
+        if (max_entry_weight == 0) {
+            max_entry_weight = capacity;
+        }
+        //shard should hold at least 4 largest entries, LRU order of tiny shards is too rough
+        shards_amount = std::max<size_t>(std::min(shards_amount, capacity / (4 * std::max<size_t>(max_entry_weight, 1))), 1);
+
+        shard_capacity = std::max<size_t>((capacity + shards_amount - 1) / shards_amount, 1);
+        max_weight = std::min(max_entry_weight, shard_capacity);
+        for (size_t i = 0; i < shards_amount; i++) {
+            shards.emplace_back(new shard());
+        }
+    }
+
     lru_cache(lru_cache const&) = delete;
     lru_cache& operator=(lru_cache const&) = delete;
-    
-    lru_cache(lru_cache&&) = default;
-    lru_cache& operator=(lru_cache&&) = default;
-    
-    template<typename VV>
-    void append(K const& key, VV&& value) {
-        std::unique_lock<std::mutex> lock(mutex);
-        
-        if (map.find(key) != map.end()) {
-            map[key]->second = std::forward<VV>(value);
-            lst.splice(lst.begin(), lst, map[key]);
-        } else {
-            lst.emplace_front(key, std::forward<VV>(value));
+
+    size_t max_entry_weight() const {
+        return max_weight;
+    }
+
+    // returns false if entry is too heavy to be cached
+    bool append(K const& key, V value) {
+        if (weigher(key, value) > max_weight) {
+            return false;
+        }
+        return append(key, std::make_shared<const V>(std::move(value)));
+    }
+
+    // value which is already shared isn't copied
+    bool append(K const& key, value_ptr current) {
+        size_t weight = weigher(key, *current);
+        if (weight > max_weight) {
+            return false;
         }
-        
-        map[key] = lst.begin();
-        
-        if (lst.size() > max_size) {
-            map.erase(lst.back().first);
-            lst.pop_back();
+
+        shard& s = shard_for(key);
+        std::unique_lock<std::mutex> lock(s.mutex);
+
+        auto it = s.map.find(key);
+        if (it != s.map.end()) {
+            erase(s, it->second);
+        }
+
+        s.lst.push_front(item{key, std::move(current), weight});
+        s.map[key] = s.lst.begin();
+        s.weight += weight;
+
+        while (s.weight > shard_capacity) {
+            erase(s, std::prev(s.lst.end()));
         }
+        return true;
     }
-    
-    inline bool is_cached(const K& key) const {
-        std::unique_lock<std::mutex> lock(mutex);
-        return map.find(key) != map.end();
+
+    // returns nullptr if key isn't cached
+    value_ptr find(K const& key) {
+        shard& s = shard_for(key);
+        std::unique_lock<std::mutex> lock(s.mutex);
+
+        auto it = s.map.find(key);
+        if (it == s.map.end()) {
+            misses++;
+            return nullptr;
+        }
+        hits++;
+        s.lst.splice(s.lst.begin(), s.lst, it->second);
+        return it->second->value;
     }
-    
-    const V& get(const K& key) const {
-        std::unique_lock<std::mutex> lock(mutex);
-        
-        auto it = map.find(key);
-        if (it == map.end()) {
-            throw std::exception();
-        } else {
-            return it->second->second;
+
+    statistics get_statistics() {
+        statistics result{hits, misses, 0, 0};
+        for (auto& s: shards) {
+            std::unique_lock<std::mutex> lock(s->mutex);
+            result.entries += s->lst.size();
+            result.weight += s->weight;
         }
+        return result;
     }
 };
 
+template<typename K, typename V, typename Weigher, typename Hash>
+const size_t lru_cache<K, V, Weigher, Hash>::DEFAULT_SHARDS;
+
 #endif /* lru_cache_hpp */
@@ -9,15 +9,188 @@
 #include <iostream>
 #include <thread>
 #include <signal.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdlib>
+#include <algorithm>
 
 #include "socket.hpp"
 #include "tcp_connection.hpp"
 #include "event_queue.hpp"
 #include "proxy.hpp"
 
-int main(int argc, const char * argv[]) {
-    event_queue kq;
-    proxy proxy_server{&kq};
+static const size_t DEFAULT_CACHE_SIZE = 64; // megabytes
+static const size_t DEFAULT_MAX_OBJECT_SIZE = 1024; // kilobytes
+static const size_t DEFAULT_DISK_CACHE_SIZE = 1024; // megabytes
+static const size_t RESOLVER_CACHE_SIZE = 10000;
+
+// seconds, 0 or less is ignored
+static void read_timeout(const char* value, int& timeout) {
+    int seconds = std::atoi(value);
+    if (seconds > 0) {
+        timeout = seconds * 1000;
+    }
+}
+
+static void print_statistics(event_queue const& queue) {
+    thread_pool::statistics stat = queue.get_background_statistics();
+    std::cerr << "background tasks: completed " << stat.completed
+              << ", queued " << stat.queued
+              << ", running " << stat.running
+              << ", threads " << stat.threads << std::endl;
+    
+    std::cerr << "wait time histogram (us):";
+    for (size_t i = 0; i < thread_pool::HISTOGRAM_SIZE; i++) {
+        if (stat.wait_histogram[i] != 0) {
+            std::cerr << ' ' << (i + 1 == thread_pool::HISTOGRAM_SIZE ? ">=" : "<") << (1 << i) << ':' << stat.wait_histogram[i];
+        }
+    }
+    std::cerr << std::endl;
+}
 
-    proxy_server.main_loop();
+static void print_cache_statistics(proxy::cache_type& cache) {
+    proxy::cache_type::statistics stat = cache.get_statistics();
+    size_t lookups = stat.hits + stat.misses;
+    std::cerr << "responce cache: " << stat.entries << " entries, "
+              << stat.weight << " bytes resident, hit ratio "
+              << (lookups == 0 ? 0 : 100 * stat.hits / lookups) << "% ("
+              << stat.hits << '/' << lookups << ')' << std::endl;
+}
+
+static void print_disk_statistics(disk_cache& cache) {
+    disk_cache::statistics stat = cache.get_statistics();
+    size_t lookups = stat.hits + stat.misses;
+    std::cerr << "disk cache: " << stat.entries << " entries in " << stat.segments << " segments, "
+              << stat.bytes << " bytes, hit ratio "
+              << (lookups == 0 ? 0 : 100 * stat.hits / lookups) << "% ("
+              << stat.hits << '/' << lookups << ')' << std::endl;
+}
+
+int main(int argc, const char * argv[]) {
+    /*
+     splice and sendfile can't be told MSG_NOSIGNAL,
+     peer which closed connection is reported by EPIPE instead
+     */
+    signal(SIGPIPE, SIG_IGN);
+    
+    std::string backend_name;
+    size_t workers = 1;
+    size_t background_threads = event_queue::DEFAULT_BACKGROUND_THREADS;
+    size_t max_background_threads = 0;
+    size_t cache_size = DEFAULT_CACHE_SIZE;
+    size_t max_object_size = DEFAULT_MAX_OBJECT_SIZE;
+    std::string disk_cache_directory;
+    size_t disk_cache_size = DEFAULT_DISK_CACHE_SIZE;
+    connection_timeouts timeouts;
+    size_t memory_limit = 0; // megabytes, 0 means no limit
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::string(argv[i]) == "--backend") {
+            backend_name = argv[++i];
+        } else if (std::string(argv[i]) == "--workers") {
+            workers = std::max(1, std::atoi(argv[++i]));
+        } else if (std::string(argv[i]) == "--background-threads") {
+            background_threads = std::max(1, std::atoi(argv[++i]));
+        } else if (std::string(argv[i]) == "--max-background-threads") {
+            max_background_threads = std::max(1, std::atoi(argv[++i]));
+        } else if (std::string(argv[i]) == "--cache-size") {
+            cache_size = std::max(0, std::atoi(argv[++i]));
+        } else if (std::string(argv[i]) == "--max-object-size") {
+            max_object_size = std::max(1, std::atoi(argv[++i]));
+        } else if (std::string(argv[i]) == "--disk-cache") {
+            disk_cache_directory = argv[++i];
+        } else if (std::string(argv[i]) == "--disk-cache-size") {
+            disk_cache_size = std::max(1, std::atoi(argv[++i]));
+        } else if (std::string(argv[i]) == "--memory-limit") {
+            memory_limit = std::max(0, std::atoi(argv[++i]));
+        } else if (std::string(argv[i]) == "--idle-timeout") {
+            read_timeout(argv[++i], timeouts.idle);
+        } else if (std::string(argv[i]) == "--header-timeout") {
+            read_timeout(argv[++i], timeouts.header);
+        } else if (std::string(argv[i]) == "--connect-timeout") {
+            read_timeout(argv[++i], timeouts.connect);
+        } else if (std::string(argv[i]) == "--responce-timeout") {
+            read_timeout(argv[++i], timeouts.responce);
+        }
+    }
+    if (max_background_threads < background_threads) {
+        max_background_threads = 4 * background_threads;
+    }
+    
+    // buffered bodies of all reactors together, reading is throttled above it
+    slab_pool::set_memory_limit(memory_limit * 1024 * 1024);
+    
+    // caches are shared between all reactors
+    proxy::cache_type responce_cache(cache_size * 1024 * 1024, max_object_size * 1024);
+    dns_cache resolver_cache(RESOLVER_CACHE_SIZE);
+    // outlives event queues, their background threads write to it
+    std::unique_ptr<disk_cache> disk;
+    if (disk_cache_directory.size() != 0) {
+        try {
+            disk.reset(new disk_cache(disk_cache_directory, uint64_t(disk_cache_size) * 1024 * 1024));
+            print_disk_statistics(*disk);
+        } catch (std::exception const& e) {
+            std::cerr << e.what() << ", disk cache is disabled" << std::endl;
+        }
+    }
+    
+    if (workers == 1) {
+        event_queue queue{make_backend(backend_name), background_threads, max_background_threads};
+        std::cerr << "event backend: " << queue.backend_name() << std::endl;
+        proxy proxy_server{&queue, &responce_cache, disk.get(), &resolver_cache, timeouts};
+        
+        proxy_server.main_loop();
+        print_statistics(queue);
+        print_cache_statistics(responce_cache);
+        if (disk) {
+            print_disk_statistics(*disk);
+        }
+        return 0;
+    }
+    
+    /*
+     every worker has it's own event_queue and it's own listener (SO_REUSEPORT),
+     SIGINT is blocked in all of them and handled here
+     */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    
+    std::vector<std::unique_ptr<event_queue>> queues;
+    std::vector<std::unique_ptr<proxy>> proxies;
+    std::vector<std::thread> threads;
+    
+    for (size_t i = 0; i < workers; i++) {
+        queues.emplace_back(new event_queue{make_backend(backend_name), background_threads, max_background_threads});
+        proxies.emplace_back(new proxy{queues.back().get(), &responce_cache, disk.get(), &resolver_cache, timeouts, false});
+    }
+    std::cerr << "event backend: " << queues.front()->backend_name() << ", workers: " << workers << std::endl;
+    
+    for (auto& proxy_server: proxies) {
+        proxy* current = proxy_server.get();
+        threads.push_back(std::thread(
+                                      [current]() {
+                                          current->main_loop();
+                                      }
+                          ));
+    }
+    
+    int signal;
+    sigwait(&mask, &signal);
+    std::cout << "SIGINT";
+    
+    for (auto& proxy_server: proxies) {
+        proxy_server->stop();
+    }
+    for (auto& thread: threads) {
+        thread.join();
+    }
+    for (auto& queue: queues) {
+        print_statistics(*queue);
+    }
+    print_cache_statistics(responce_cache);
+    if (disk) {
+        print_disk_statistics(*disk);
+    }
 }
@@ -0,0 +1,90 @@
+//
+//  mpsc_queue.hpp
+//  simple_proxy
+//
+
+#ifndef mpsc_queue_hpp
+#define mpsc_queue_hpp
+
+#include <stdio.h>
+#include <atomic>
+#include <utility>
+
+/*
+ lock-free multiple producers single consumer queue.
+ Producers push into intrusive stack with one CAS,
+ consumer takes the whole stack at once and runs it in FIFO order
+ */
+template<typename T>
+struct mpsc_queue {
+private:
+    struct node {
+        T value;
+        node* next;
+    };
+
+    std::atomic<node*> head{nullptr};
+
+    static void destroy(node* current) {
+        while (current) {
+            node* next = current->next;
+            delete current;
+            current = next;
+        }
+    }
+public:
+    mpsc_queue() {}
+
+    mpsc_queue(mpsc_queue const&) = delete;
+    mpsc_queue& operator=(mpsc_queue const&) = delete;
+
+    ~mpsc_queue() {
+        destroy(head.load(std::memory_order_acquire));
+    }
+
+    /*
+     could be called from any thread
+     returns true if queue was empty, i.e. consumer has to be woken up
+     */
+    bool push(T value) {
+        //node could be consumed and deleted right after CAS, it isn't touched after it
+        node* old = head.load(std::memory_order_relaxed);
+        node* current = new node{std::move(value), old};
+        while (!head.compare_exchange_weak(old, current, std::memory_order_release, std::memory_order_relaxed)) {
+            current->next = old;
+        }
+        return old == nullptr;
+    }
+
+    /*
+     consumer only
+     applies f to every element pushed before the call, in order of pushing
+     */
+    template<typename F>
+    void consume_all(F f) {
+        node* current = head.exchange(nullptr, std::memory_order_acquire);
+
+        //reverse to FIFO order
+        node* reversed = nullptr;
+        while (current) {
+            node* next = current->next;
+            current->next = reversed;
+            reversed = current;
+            current = next;
+        }
+
+        while (reversed) {
+            node* next = reversed->next;
+            try {
+                f(reversed->value);
+            } catch (...) {
+                destroy(reversed);
+                throw;
+            }
+            delete reversed;
+            reversed = next;
+        }
+    }
+};
+
+#endif /* mpsc_queue_hpp */
@@ -0,0 +1,113 @@
+//
+//  object_pool.hpp
+//  simple_proxy
+//
+
+#ifndef object_pool_hpp
+#define object_pool_hpp
+
+#include <stdio.h>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+/*
+ objects of one type placed in arenas of ARENA_OBJECTS slots.
+ Destroyed objects' slots go to free list and are reused first,
+ arenas are freed only with the pool.
+ One per reactor, not thread-safe
+ */
+template<typename T>
+struct object_pool {
+    static const size_t ARENA_OBJECTS = 64;
+
+    // returns slot to pool it came from
+    struct deleter {
+        object_pool* pool = nullptr;
+
+        deleter() {}
+        deleter(object_pool* pool) : pool(pool) {}
+
+        void operator()(T* object) const {
+            pool->destroy(object);
+        }
+    };
+
+    using pointer = std::unique_ptr<T, deleter>;
+
+    object_pool() {}
+
+    ~object_pool() {
+        for (slot* arena: arenas) {
+            delete[] arena;
+        }
+    }
+
+    object_pool(object_pool const&) = delete;
+    object_pool& operator=(object_pool const&) = delete;
+
+    template<typename... Args>
+    T* create(Args&&... args) {
+        slot* place = take();
+        try {
+            T* object = new (place->storage) T(std::forward<Args>(args)...);
+            used++;
+            return object;
+        } catch (...) {
+            put(place);
+            throw;
+        }
+    }
+
+    // create, but object goes back to pool by itself
+    template<typename... Args>
+    pointer make(Args&&... args) {
+        return pointer(create(std::forward<Args>(args)...), deleter(this));
+    }
+
+    void destroy(T* object) {
+        object->~T();
+        used--;
+        put(reinterpret_cast<slot*>(object));
+    }
+
+    // objects currently alive
+    size_t in_use() const {
+        return used;
+    }
+
+private:
+    union slot {
+        slot* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    std::vector<slot*> arenas;
+    slot* free_slots = nullptr;
+    size_t used = 0;
+
+    slot* take() {
+        if (free_slots == nullptr) {
+            slot* arena = new slot[ARENA_OBJECTS];
+            arenas.push_back(arena);
+            for (size_t i = 0; i < ARENA_OBJECTS; i++) {
+                put(arena + i);
+            }
+        }
+        slot* result = free_slots;
+        free_slots = result->next;
+        return result;
+    }
+
+    void put(slot* place) {
+        place->next = free_slots;
+        free_slots = place;
+    }
+};
+
+template<typename T>
+const size_t object_pool<T>::ARENA_OBJECTS;
+
+#endif /* object_pool_hpp */
@@ -8,10 +8,10 @@
 #include <memory>
 #include <stdio.h>
 #include <sys/socket.h>
-#include <sys/event.h>
 #include <arpa/inet.h>
 #include <exception>
-#include <sys/fcntl.h>
+#include <fcntl.h>
+#include <signal.h>
 
 main_server::main_server(int port) : port(port) {
     server_socket = socket(AF_INET, SOCK_STREAM, 0);
@@ -44,62 +44,77 @@ main_server::main_server(int port) : port(port) {
     }
 }
 
-proxy::proxy(event_queue* queue)
+proxy::proxy(event_queue* queue, cache_type* responce_cache, disk_cache* disk, dns_cache* resolver_cache, connection_timeouts const& timeouts, bool handle_signals)
 : queue(queue)
+, responce_cache(responce_cache)
+, disk(disk)
+, resolver_cache(resolver_cache)
+, timeouts(timeouts)
 , connect_server(main_server{2539})
-, responce_cache(100)
-, resolver_cache(10000)
+, resolver(queue, resolver_cache)
+, pool(queue)
 , reg(
       queue,
       connect_server.get_socket(),
-      EVFILT_READ,
-      [this, queue](struct kevent& event) {
+      FILTER_READ,
+      [this, queue](queue_event& event) {
           try {
-              auto temp = std::unique_ptr<tcp_connection>(new tcp_connection(queue, &responce_cache, &resolver_cache, connect_server.get_socket()));
+              tcp_connection* connection = connection_pool.create(queue, this->responce_cache, this->disk, &resolver, &pool, &slabs, &clients, &this->timeouts, connect_server.get_socket());
+              connections.push_back(connection);
               
-              auto iter = connections.insert(std::move(temp)).first;
-              
-              std::function<void()> deleter = [this, iter]() {
-                  deleted.push_back(iter);
+              std::function<void()> deleter = [this, connection]() {
+                  if (connections.contains(connection)) {
+                      connections.erase(connection);
+                      deleted.push_back(connection);
+                  }
               };
               
-              (*iter)->set_deleter(deleter);
-              (*iter)->start();
+              connection->set_deleter(deleter);
+              connection->start();
           } catch (std::exception const& e) {
               std::cerr << e.what() << std::endl;
           }
       },
       true
       )
-, sigint(
-         queue,
-         SIGINT,
-         EVFILT_SIGNAL,
-         [this](struct kevent event) {
-             std::cout << "SIGINT";
-             hard_stop();
-         },
-         true
-         )
-{}
+{
+    if (handle_signals) {
+        sigint = event_registration{
+            queue,
+            SIGINT,
+            FILTER_SIGNAL,
+            [this](queue_event& event) {
+                std::cout << "SIGINT";
+                hard_stop();
+            },
+            true
+        };
+    }
+}
 
 proxy::~proxy() {
     reg.stop_listen();
     sigint.stop_listen();
     queue->stop_resolve();
+    destroy(deleted);
+    destroy(connections);
+}
+
+void proxy::destroy(intrusive_list<tcp_connection>& list) {
+    while (!list.empty()) {
+        tcp_connection* connection = list.front();
+        list.erase(connection);
+        connection_pool.destroy(connection);
+    }
 }
 
 void proxy::main_loop() {
     try {
         while (work) {
-            for (auto& conn_iter: deleted) {
-                connections.erase(conn_iter);
-            }
-            deleted.clear();
+            destroy(deleted);
             
-            if (int amount = queue->occurred()) {
-                queue->execute(amount);
-            }
+            //nothing could occur if wait is interrupted by deadline
+            queue->execute(queue->occurred());
             
             if (soft_exit && connections.size() == 0) {
                 return;
@@ -117,6 +132,13 @@ void proxy::hard_stop() {
 }
 
 
+void proxy::stop() {
+    queue->execute_in_main(task{[this]() {
+        hard_stop();
+    }});
+}
+
+
 void proxy::soft_stop() {
     soft_exit = true;
     reg.stop_listen();
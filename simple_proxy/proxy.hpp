@@ -12,11 +12,20 @@
 #include <stdio.h>
 #include <vector>
 #include <utility>
+#include <unistd.h>
 #include "event_queue.hpp"
 #include "tcp_connection.hpp"
+#include "proxy_client.h"
 #include "event_registration.h"
 #include "lru_cache.hpp"
+#include "disk_cache.hpp"
 #include "custom_exception.hpp"
+#include "dns_resolver.hpp"
+#include "upstream_pool.hpp"
+#include "slab_buffer.hpp"
+#include "object_pool.hpp"
+#include "intrusive_list.hpp"
+#include "connection_timeouts.hpp"
 
 struct main_server {
 public:
@@ -45,7 +54,14 @@ struct tcp_connection;
 
 struct proxy {
 public:
-    proxy(event_queue* queue);
+    // capacity is in bytes
+    using cache_type = lru_cache<std::string, std::string, string_entry_size>;
+    
+    /*
+     caches could be shared between several proxies running in different threads
+     if handle_signals is false SIGINT should be handled by owner via stop()
+     */
+    proxy(event_queue* queue, cache_type* responce_cache, disk_cache* disk, dns_cache* resolver_cache, connection_timeouts const& timeouts = connection_timeouts(), bool handle_signals = true);
     ~proxy();
     
     proxy(proxy const&) = delete;
@@ -56,23 +72,40 @@ public:
     
     void main_loop();
     void soft_stop();
+    
+    // could be called from any thread
+    void stop();
 private:
     void hard_stop();
+    void destroy(intrusive_list<tcp_connection>& list);
     
-    main_server connect_server;
+    // everything listener uses is declared (so initialized) before it
     event_queue* queue;
+    cache_type* responce_cache;
+    disk_cache* disk;
+    dns_cache* resolver_cache;
+    connection_timeouts timeouts;
+    
+    main_server connect_server;
+    dns_resolver resolver;
+    // idle connections to servers, shared by all client connections
+    upstream_pool pool;
+    // slabs for buffers of all connections
+    slab_pool slabs;
+    
+    // connections and their sockets, accept and close don't touch general allocator
+    object_pool<tcp_connection> connection_pool;
+    object_pool<proxy_client> clients;
+    
+    intrusive_list<tcp_connection> connections;
+    // dead connections, they're destroyed out of their own handlers
+    intrusive_list<tcp_connection> deleted;
     
     bool work = true;
     bool soft_exit = false;
     
     event_registration reg;
     event_registration sigint;
-    
-    std::set<std::unique_ptr<tcp_connection>> connections;
-    std::vector<decltype(connections.begin())> deleted;
-    
-    lru_cache<std::string, std::string> responce_cache;
-    lru_cache<std::string, std::string> resolver_cache;
 };
 
 #endif /* proxy_hpp */
@@ -4,8 +4,15 @@
 
 #include "proxy_client.h"
 
-proxy_client::proxy_client(std::string const& ip, std::string const& host, size_t port)
-: client_socket(ip, port), host(host) {std::cout << host << std::endl;}
+#include <unistd.h>
+#include <cerrno>
+#include <vector>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+proxy_client::proxy_client(int descriptor, std::string const& host)
+: client_socket(descriptor, socket::connected), host(host) {std::cout << host << std::endl;}
 
 
 proxy_client::proxy_client(int descriptor)
@@ -13,18 +20,62 @@ proxy_client::proxy_client(int descriptor)
 
 size_t proxy_client::send(std::string const& request) {
     if (request.size() == 0) return 0;  
+#ifdef MSG_NOSIGNAL
+    ssize_t len = ::send(get_socket(), request.c_str(), request.size(), MSG_NOSIGNAL);
+#else
     ssize_t len = ::send(get_socket(), request.c_str(), request.size(), 0);
+#endif
 
     if (len == -1) len = 0;
     return static_cast<size_t>(len);
 }
 
-std::string proxy_client::read(size_t len) {
-    std::vector<int> buf(len);
-    ssize_t new_len = ::recv(get_socket(), buf.data(), len, 0);
+size_t proxy_client::read(char* data, size_t len) {
+    ssize_t new_len = ::recv(get_socket(), data, len, 0);
     if (new_len == -1) {
-        return "";
+        return 0;
+    }
+    return static_cast<size_t>(new_len);
+}
+
+size_t proxy_client::send(const struct iovec* parts, int count) {
+    if (count == 0) return 0;
+    // sendmsg instead of writev to pass MSG_NOSIGNAL
+    struct msghdr message{};
+    message.msg_iov = const_cast<struct iovec*>(parts);
+    message.msg_iovlen = count;
+#ifdef MSG_NOSIGNAL
+    ssize_t len = ::sendmsg(get_socket(), &message, MSG_NOSIGNAL);
+#else
+    ssize_t len = ::sendmsg(get_socket(), &message, 0);
+#endif
+
+    if (len == -1) len = 0;
+    return static_cast<size_t>(len);
+}
+
+size_t proxy_client::read(const struct iovec* parts, int count) {
+    if (count == 0) return 0;
+    ssize_t len = ::readv(get_socket(), parts, count);
+    if (len == -1) len = 0;
+    return static_cast<size_t>(len);
+}
+
+bool proxy_client::send_file(int file, off_t& offset, size_t len) {
+#ifdef __linux__
+    // kernel copies file to socket, nothing goes through user space
+    ssize_t sent = ::sendfile(get_socket(), file, &offset, len);
+#else
+    std::vector<char> buf(std::min<size_t>(len, 1 << 16));
+    ssize_t readed = ::pread(file, buf.data(), buf.size(), offset);
+    if (readed <= 0) {
+        return true;
+    }
+    ssize_t sent = ::send(get_socket(), buf.data(), static_cast<size_t>(readed), 0);
+    if (sent > 0) {
+        offset += sent;
     }
-    
-    return std::string(buffer.begin(), buffer().begin() + new_len);
+#endif
+    // SIGPIPE is ignored, closed peer is reported by errno
+    return sent != -1 || (errno != EPIPE && errno != ECONNRESET);
 }
@@ -8,13 +8,17 @@
 
 #include <iosfwd>
 #include <assert.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 #include "socket.hpp"
 #include "event_registration.h"
 
 struct proxy_client {
 public:
-    proxy_client(std::string const& ip, std::string const& host = "localhost", size_t port = 80);
+    // takes ownership of connected descriptor
+    proxy_client(int descriptor, std::string const& host);
 
+    // accepts connection on listening descriptor
     proxy_client(int descriptor);
 
     proxy_client(proxy_client const&) = delete;
@@ -29,7 +33,18 @@ public:
 
     size_t send(std::string const& request);
 
-    std::string read(size_t len);
+    // returns amount of received bytes, 0 if there is nothing to read
+    size_t read(char* data, size_t len);
+
+    // scatter/gather versions, return amount of transferred bytes
+    size_t send(const struct iovec* parts, int count);
+    size_t read(const struct iovec* parts, int count);
+
+    /*
+     sends up to len bytes of file starting from offset, offset is moved forward.
+     Returns false if peer closed connection (EPIPE, ECONNRESET)
+     */
+    bool send_file(int file, off_t& offset, size_t len);
 
     std::string const& get_host() const {
         return host;
@@ -71,6 +86,13 @@ public:
         resume_write();
     }
 
+    // stops listening and gives descriptor away, object is unusable after that
+    int release() {
+        event_read.invalidate();
+        event_write.invalidate();
+        return client_socket.release();
+    }
+
     event_registration& get_event_read() {
         return event_read;
     }
@@ -0,0 +1,309 @@
+//
+//  slab_buffer.cpp
+//  simple_proxy
+//
+
+#include "slab_buffer.hpp"
+
+#include <assert.h>
+#include <algorithm>
+#include <cstring>
+
+const size_t slab_pool::SLAB_SIZE = 16 * 1024;
+std::atomic<size_t> slab_pool::total_used(0);
+size_t slab_pool::memory_limit = 0;
+
+void slab_pool::set_memory_limit(size_t bytes) {
+    memory_limit = bytes;
+}
+
+size_t slab_pool::memory_in_use() {
+    return total_used.load(std::memory_order_relaxed) * SLAB_SIZE;
+}
+
+bool slab_pool::is_over_limit() {
+    return memory_limit != 0 && memory_in_use() >= memory_limit;
+}
+
+slab_pool::slab_pool(size_t max_free)
+    : max_free(max_free)
+{}
+
+slab_pool::~slab_pool() {
+    for (char* slab: free_slabs) {
+        delete[] slab;
+    }
+    delete[] scratch_slab;
+}
+
+char* slab_pool::scratch() {
+    if (scratch_slab == nullptr) {
+        scratch_slab = new char[SLAB_SIZE];
+    }
+    return scratch_slab;
+}
+
+char* slab_pool::allocate() {
+    used++;
+    total_used.fetch_add(1, std::memory_order_relaxed);
+    if (free_slabs.size() == 0) {
+        return new char[SLAB_SIZE];
+    }
+    char* slab = free_slabs.back();
+    free_slabs.pop_back();
+    return slab;
+}
+
+void slab_pool::release(char* slab) {
+    used--;
+    total_used.fetch_sub(1, std::memory_order_relaxed);
+    if (free_slabs.size() < max_free) {
+        free_slabs.push_back(slab);
+    } else {
+        delete[] slab;
+    }
+}
+
+buffer::buffer(slab_pool* pool)
+    : pool(pool)
+{}
+
+buffer::buffer(slab_pool* pool, std::string const& chunk)
+    : pool(pool)
+    , available_data(-1)
+{
+    append(chunk);
+    available_data = 0;
+}
+
+buffer::buffer(slab_pool* pool, std::string const& chunk, int amount_of_data)
+    : pool(pool)
+    , available_data(amount_of_data)
+{
+    append(chunk);
+}
+
+buffer::~buffer() {
+    release_all();
+}
+
+buffer::buffer(buffer&& other) {
+    *this = std::move(other);
+}
+
+buffer& buffer::operator=(buffer&& other) {
+    if (this == &other) {
+        return *this;
+    }
+    release_all();
+    pool = other.pool;
+    slabs = std::move(other.slabs);
+    spare = std::move(other.spare);
+    head = other.head;
+    end = other.end;
+    length = other.length;
+    available_data = other.available_data;
+    decoding = other.decoding;
+    decoder = other.decoder;
+    overflow = std::move(other.overflow);
+    keep = other.keep;
+    all_data = std::move(other.all_data);
+
+    other.slabs.clear();
+    other.spare.clear();
+    other.clear();
+    return *this;
+}
+
+void buffer::release_all() {
+    for (char* slab: slabs) {
+        pool->release(slab);
+    }
+    for (char* slab: spare) {
+        pool->release(slab);
+    }
+    slabs.clear();
+    spare.clear();
+    head = end = length = 0;
+}
+
+size_t buffer::note(const char* data, size_t size) {
+    if (decoding) {
+        //bytes after the end of message aren't taken
+        size_t used = decoder.feed(data, size);
+        if (decoder.is_done() || decoder.is_failed()) {
+            available_data = 0;
+        }
+        if (decoder.is_done()) {
+            overflow.append(data + used, size - used);
+        }
+        size = used;
+    } else if (available_data != -1) {
+        available_data -= size;
+    }
+
+    if (keep) {
+        all_data.append(data, size);
+    }
+    length += size;
+    return size;
+}
+
+void buffer::decode_chunks() {
+    decoding = true;
+    decoder.clear();
+    available_data = -1;
+}
+
+void buffer::append(std::string const& chunk) {
+    //nothing is taken after the end of data
+    size_t size = chunk.size();
+    if (available_data != -1) {
+        size = std::min(size, static_cast<size_t>(available_data));
+        overflow.append(chunk, size, std::string::npos);
+    }
+
+    size_t copied = 0;
+    while (copied != size && available_data != 0) {
+        if (slabs.size() == 0 || end == slab_pool::SLAB_SIZE) {
+            slabs.push_back(pool->allocate());
+            end = 0;
+        }
+        size_t part = std::min(size - copied, slab_pool::SLAB_SIZE - end);
+        std::memcpy(slabs.back() + end, chunk.data() + copied, part);
+        end += note(slabs.back() + end, part);
+        copied += part;
+    }
+    if (available_data == 0 && copied < size) {
+        overflow.append(chunk, copied, size - copied);
+    }
+    if (end == 0 && slabs.size() != 0) {
+        //nothing was taken to the new slab
+        pool->release(slabs.back());
+        slabs.pop_back();
+        end = slabs.size() == 0 ? 0 : slab_pool::SLAB_SIZE;
+    }
+}
+
+int buffer::prepare(struct iovec* parts, int count) {
+    size_t space = available_data == -1 ? static_cast<size_t>(-1) : static_cast<size_t>(available_data);
+    int filled = 0;
+
+    if (slabs.size() != 0 && end != slab_pool::SLAB_SIZE && filled < count && space != 0) {
+        size_t part = std::min(space, slab_pool::SLAB_SIZE - end);
+        parts[filled].iov_base = slabs.back() + end;
+        parts[filled].iov_len = part;
+        filled++;
+        space -= part;
+    }
+
+    for (size_t i = 0; filled < count && space != 0; i++) {
+        if (i == spare.size()) {
+            spare.push_back(pool->allocate());
+        }
+        size_t part = std::min(space, slab_pool::SLAB_SIZE);
+        parts[filled].iov_base = spare[i];
+        parts[filled].iov_len = part;
+        filled++;
+        space -= part;
+    }
+    return filled;
+}
+
+void buffer::commit(size_t amount) {
+    //the same order as in prepare: end of the last slab, then spare ones
+    if (slabs.size() != 0 && end != slab_pool::SLAB_SIZE) {
+        size_t part = std::min(amount, slab_pool::SLAB_SIZE - end);
+        end += note(slabs.back() + end, part);
+        amount -= part;
+    }
+
+    //filled slabs are always at the beginning of spare ones
+    size_t index = 0;
+    size_t used = 0;
+    while (amount != 0) {
+        assert(index < spare.size());
+        char* slab = spare[index++];
+        size_t part = std::min(amount, slab_pool::SLAB_SIZE);
+        amount -= part;
+        if (available_data == 0) {
+            //bytes after the end of message are kept apart
+            overflow.append(slab, part);
+            continue;
+        }
+        size_t taken = note(slab, part);
+        if (taken != 0) {
+            slabs.push_back(slab);
+            end = taken;
+            used++;
+        }
+    }
+    
+    //unused ones go back to pool, buffer keeps only data
+    for (size_t i = used; i < spare.size(); i++) {
+        pool->release(spare[i]);
+    }
+    spare.clear();
+}
+
+int buffer::get(struct iovec* parts, int count) const {
+    int filled = 0;
+    for (size_t i = 0; i < slabs.size() && filled < count; i++) {
+        size_t from = i == 0 ? head : 0;
+        size_t to = i + 1 == slabs.size() ? end : slab_pool::SLAB_SIZE;
+        if (from == to) {
+            continue;
+        }
+        parts[filled].iov_base = slabs[i] + from;
+        parts[filled].iov_len = to - from;
+        filled++;
+    }
+    return filled;
+}
+
+void buffer::pop_front(size_t amount) {
+    assert(amount <= length);
+    length -= amount;
+    head += amount;
+
+    //sent slabs are returned to pool immediately
+    while (slabs.size() != 0) {
+        size_t size = slabs.size() == 1 ? end : slab_pool::SLAB_SIZE;
+        if (head < size) {
+            break;
+        }
+        head -= size;
+        pool->release(slabs.front());
+        slabs.pop_front();
+    }
+    if (slabs.size() == 0) {
+        head = end = 0;
+    }
+}
+
+void buffer::clear() {
+    release_all();
+    available_data = 0;
+    decoding = false;
+    decoder.clear();
+    overflow.clear();
+    keep = false;
+    all_data.clear();
+}
+
+std::string buffer::take_overflow() {
+    std::string result;
+    result.swap(overflow);
+    return result;
+}
+
+void buffer::keep_all_data() {
+    keep = true;
+    all_data.clear();
+    all_data.reserve(length);
+    for (size_t i = 0; i < slabs.size(); i++) {
+        size_t from = i == 0 ? head : 0;
+        size_t to = i + 1 == slabs.size() ? end : slab_pool::SLAB_SIZE;
+        all_data.append(slabs[i] + from, to - from);
+    }
+}
@@ -0,0 +1,159 @@
+//
+//  slab_buffer.hpp
+//  simple_proxy
+//
+
+#ifndef slab_buffer_hpp
+#define slab_buffer_hpp
+
+#include <stdio.h>
+#include <cstddef>
+#include <string>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <sys/uio.h>
+#include "chunk_decoder.hpp"
+
+/*
+ free list of fixed-size memory blocks.
+ One per reactor, not thread-safe, except of counter of memory of all pools
+ */
+struct slab_pool {
+    static const size_t SLAB_SIZE;
+
+    // at most max_free released slabs are kept for reuse, others are freed
+    explicit slab_pool(size_t max_free = 1024);
+    ~slab_pool();
+
+    slab_pool(slab_pool const&) = delete;
+    slab_pool& operator=(slab_pool const&) = delete;
+
+    char* allocate();
+    void release(char* slab);
+
+    // one slab for temporary data, it's reused by everybody
+    char* scratch();
+
+    // slabs currently owned by buffers
+    size_t in_use() const {
+        return used;
+    }
+
+    // bytes in slabs owned by buffers of all pools, 0 limit means no limit
+    static void set_memory_limit(size_t bytes);
+    static size_t memory_in_use();
+    static bool is_over_limit();
+private:
+    static std::atomic<size_t> total_used;
+    static size_t memory_limit;
+
+    std::vector<char*> free_slabs;
+    size_t max_free;
+    size_t used = 0;
+    char* scratch_slab = nullptr;
+};
+
+/*
+ queue of bytes stored in chain of slabs.
+ Socket reads straight to the free space at the end (prepare + commit),
+ socket writes straight from the beginning (get + pop_front).
+ Sent slabs go back to the pool at once, so only bytes in flight are kept
+ */
+struct buffer {
+private:
+    slab_pool* pool = nullptr;
+    std::deque<char*> slabs;
+
+    // first unsent byte in the first slab and end of data in the last slab
+    size_t head = 0;
+    size_t end = 0;
+    size_t length = 0;
+
+    // slabs given out by prepare, but not filled yet, they're returned to pool by commit
+    std::vector<char*> spare;
+
+    /*
+     amount of data that server or client could add to body_buffer
+     0 means server or client finish reading data
+     -1 means chunked encoding(infinity)
+     */
+    int available_data = 0;
+
+    // end of chunked body is found by decoder
+    bool decoding = false;
+    chunk_decoder decoder;
+
+    // bytes after the end of message, they belong to the next one
+    std::string overflow;
+
+    // copy of everything appended, kept only if somebody needs whole data (cache)
+    bool keep = false;
+    std::string all_data;
+
+    // bookkeeping for bytes that were just added, returns how many of them belong to message
+    size_t note(const char* data, size_t size);
+    void release_all();
+
+public:
+    // maximum number of parts filled by get
+    static const int MAX_PARTS = 16;
+
+    buffer() {};
+    buffer(slab_pool* pool);
+    buffer(slab_pool* pool, std::string const& chunk);
+    buffer(slab_pool* pool, std::string const& chunk, int amount_of_data);
+    ~buffer();
+
+    buffer(buffer const&) = delete;
+    buffer& operator=(buffer const&) = delete;
+
+    buffer(buffer&&);
+    buffer& operator=(buffer&&);
+
+    int amount_of_available_data() const {
+        return available_data;
+    }
+
+    void append(std::string const& chunk);
+
+    // data appended after this call is chunked body, buffer is complete when it ends
+    void decode_chunks();
+
+    // returns bytes which came after the end of message
+    std::string take_overflow();
+
+    // chunked body was malformed
+    bool is_broken() const {
+        return decoding && decoder.is_failed();
+    }
+
+    /*
+     describes free space for at most count parts (for readv), nothing if no more data is expected.
+     Returns number of filled parts
+     */
+    int prepare(struct iovec* parts, int count);
+
+    // amount bytes were written to prepared space
+    void commit(size_t amount);
+
+    // describes unsent data (for writev), returns number of filled parts
+    int get(struct iovec* parts, int count) const;
+
+    void pop_front(size_t amount);
+
+    void clear();
+
+    // starts keeping copy of all data, including already appended
+    void keep_all_data();
+
+    std::string const& get_all_data() const {
+        return all_data;
+    }
+
+    size_t size() const {
+        return length;
+    }
+};
+
+#endif /* slab_buffer_hpp */
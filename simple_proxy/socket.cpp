@@ -12,10 +12,13 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <cstring>
 #include <cmath>
 #include <string>
 
+const socket::connected_t socket::connected{};
+
 void set_socket_properties(int client_socket) {
     if (client_socket == -1) {
         std::string message{"fail to create socket: "};
@@ -33,8 +36,10 @@ void set_socket_properties(int client_socket) {
         throw custom_exception(message);
     }
     
+#ifdef SO_NOSIGPIPE
     const int set = 1;
     setsockopt(client_socket, SOL_SOCKET, SO_NOSIGPIPE, &set, sizeof(set));
+#endif
 }
 
 socket::socket(int descriptor) {
@@ -44,18 +49,12 @@ socket::socket(int descriptor) {
     set_socket_properties(client_socket);
 }
 
-socket::socket(std::string const& ip, size_t port) {
-    client_socket = ::socket(AF_INET, SOCK_STREAM, 0);
-    set_socket_properties(client_socket);
-    
-    sockaddr_in serv;
-    serv.sin_family = AF_INET;
-    serv.sin_addr.s_addr = inet_addr(ip.c_str());
-    serv.sin_port = htons(port);
-
-    connect(client_socket, (struct sockaddr*)&serv, sizeof(serv));
-}
+socket::socket(int descriptor, connected_t)
+    : client_socket(descriptor)
+{}
 
 socket::~socket() {
-    close(client_socket);
+    if (client_socket != -1) {
+        close(client_socket);
+    }
 }
\ No newline at end of file
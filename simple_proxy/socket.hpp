@@ -11,6 +11,12 @@
 
 #include <string>
 
+/*
+ makes descriptor non-blocking,
+ throws custom_exception if descriptor is invalid
+ */
+void set_socket_properties(int client_socket);
+
 struct socket {
 public:
     socket(socket const&) = delete;
@@ -19,9 +25,14 @@ public:
     socket(socket&&) = delete;
     socket& operator=(socket&&) = delete;
     
+    struct connected_t {};
+    static const connected_t connected;
+    
+    // accepts new connection on listening descriptor
     socket(int descriptor);
     
-    socket(std::string const& ip, size_t port);
+    // takes ownership of already connected descriptor
+    socket(int descriptor, connected_t);
 
     ~socket();
     
@@ -29,6 +40,13 @@ public:
         return client_socket;
     }
     
+    // gives descriptor away, it won't be closed by destructor
+    int release() {
+        int result = client_socket;
+        client_socket = -1;
+        return result;
+    }
+    
 private:
     int client_socket;
 };
@@ -0,0 +1,108 @@
+//
+//  splice_relay.cpp
+//  simple_proxy
+//
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <fcntl.h>
+#endif
+
+#include "splice_relay.hpp"
+
+#include <algorithm>
+#include <errno.h>
+#include <unistd.h>
+
+const size_t splice_relay::PIPE_SIZE = 1 << 18;
+
+splice_relay::~splice_relay() {
+    close_pipe();
+}
+
+bool splice_relay::is_supported() {
+#ifdef __linux__
+    return true;
+#else
+    return false;
+#endif
+}
+
+void splice_relay::close_pipe() {
+    if (pipe_in != -1) {
+        close(pipe_in);
+        close(pipe_out);
+        pipe_in = pipe_out = -1;
+    }
+}
+
+bool splice_relay::start(int from, int to, size_t amount) {
+#ifdef __linux__
+    // pipe is empty after previous relay finished, otherwise it's replaced
+    if (pipe_in != -1 && in_pipe != 0) {
+        close_pipe();
+    }
+    if (pipe_in == -1) {
+        int fds[2];
+        if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) == -1) {
+            return false;
+        }
+        pipe_out = fds[0];
+        pipe_in = fds[1];
+
+        // bigger pipe means less wakeups, default size is used if it's not allowed
+        fcntl(pipe_in, F_SETPIPE_SZ, static_cast<int>(PIPE_SIZE));
+        int size = fcntl(pipe_in, F_GETPIPE_SZ);
+        capacity = size > 0 ? static_cast<size_t>(size) : 1 << 16;
+    }
+
+    this->from = from;
+    this->to = to;
+    to_read = amount;
+    in_pipe = 0;
+    active = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool splice_relay::fill() {
+#ifdef __linux__
+    while (to_read != 0 && in_pipe < capacity) {
+        ssize_t moved = splice(from, nullptr, pipe_in, nullptr, std::min(to_read, capacity - in_pipe), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (moved == 0) {
+            return false;
+        }
+        if (moved == -1) {
+            return errno == EAGAIN || errno == EINTR;
+        }
+        to_read -= moved;
+        in_pipe += moved;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool splice_relay::drain() {
+#ifdef __linux__
+    while (in_pipe != 0) {
+        ssize_t moved = splice(pipe_out, nullptr, to, nullptr, in_pipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (moved <= 0) {
+            //EPIPE (SIGPIPE is ignored) means destination is closed
+            return moved == -1 && (errno == EAGAIN || errno == EINTR);
+        }
+        in_pipe -= moved;
+    }
+    if (is_done()) {
+        active = false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,76 @@
+//
+//  splice_relay.hpp
+//  simple_proxy
+//
+
+#ifndef splice_relay_hpp
+#define splice_relay_hpp
+
+#include <stdio.h>
+#include <cstddef>
+
+/*
+ moves fixed amount of bytes from one socket to another through pipe with splice(),
+ data never goes to user space. Only Linux has splice, elsewhere relay is never started.
+ Source and destination are non-blocking, fill and drain do as much as possible without waiting
+ */
+struct splice_relay {
+    splice_relay() {}
+    ~splice_relay();
+
+    splice_relay(splice_relay const&) = delete;
+    splice_relay& operator=(splice_relay const&) = delete;
+
+    static bool is_supported();
+
+    // returns false if pipe couldn't be created
+    bool start(int from, int to, size_t amount);
+
+    // source is readable, returns false if source is closed or failed
+    bool fill();
+
+    // destination is writable, returns false if destination failed
+    bool drain();
+
+    bool is_active() const {
+        return active;
+    }
+
+    // everything is read from source
+    bool is_read() const {
+        return to_read == 0;
+    }
+
+    bool is_pipe_empty() const {
+        return in_pipe == 0;
+    }
+
+    bool is_pipe_full() const {
+        return in_pipe >= capacity;
+    }
+
+    // everything is written to destination, relay becomes inactive
+    bool is_done() const {
+        return to_read == 0 && in_pipe == 0;
+    }
+
+    void stop() {
+        active = false;
+    }
+private:
+    static const size_t PIPE_SIZE;
+
+    int pipe_in = -1;
+    int pipe_out = -1;
+    size_t capacity = 0;
+
+    int from = -1;
+    int to = -1;
+    size_t to_read = 0;
+    size_t in_pipe = 0;
+    bool active = false;
+
+    void close_pipe();
+};
+
+#endif /* splice_relay_hpp */
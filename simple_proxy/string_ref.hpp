@@ -0,0 +1,86 @@
+//
+//  string_ref.hpp
+//  simple_proxy
+//
+
+#ifndef string_ref_hpp
+#define string_ref_hpp
+
+#include <stdio.h>
+#include <cstddef>
+#include <cstring>
+#include <cctype>
+#include <string>
+
+/*
+ non-owning view of characters, like std::string_view.
+ Valid while the string it points to isn't changed
+ */
+struct string_ref {
+    string_ref() {}
+
+    string_ref(const char* data, size_t size)
+        : ptr(data), length(size)
+    {}
+
+    string_ref(const char* data)
+        : ptr(data), length(std::strlen(data))
+    {}
+
+    string_ref(std::string const& str)
+        : ptr(str.data()), length(str.size())
+    {}
+
+    const char* data() const {
+        return ptr;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    bool empty() const {
+        return length == 0;
+    }
+
+    char operator[](size_t pos) const {
+        return ptr[pos];
+    }
+
+    std::string to_string() const {
+        return std::string(ptr, length);
+    }
+
+    string_ref substr(size_t pos, size_t count = std::string::npos) const {
+        if (pos > length) {
+            pos = length;
+        }
+        return string_ref(ptr + pos, count < length - pos ? count : length - pos);
+    }
+
+    bool equals_ignore_case(string_ref other) const {
+        if (length != other.length) {
+            return false;
+        }
+        for (size_t i = 0; i < length; i++) {
+            if (tolower(static_cast<unsigned char>(ptr[i])) != tolower(static_cast<unsigned char>(other.ptr[i]))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    const char* ptr = "";
+    size_t length = 0;
+};
+
+inline bool operator==(string_ref a, string_ref b) {
+    return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+inline bool operator!=(string_ref a, string_ref b) {
+    return !(a == b);
+}
+
+#endif /* string_ref_hpp */
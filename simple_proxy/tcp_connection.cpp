@@ -7,6 +7,7 @@
 //
 
 #include <stdio.h>
+#include <unistd.h>
 #include "socket.hpp"
 #include "tcp_connection.hpp"
 
@@ -14,124 +15,39 @@ const std::string BAD_REQUEST = "HTTP/1.1 400 Bad Request\r\nServer: proxy\r\nCo
 
 const std::string NOT_FOUND = "HTTP/1.1 404 Not Found\r\nServer: proxy\r\nContent-Type: text/html; charset=utf-8\r\nContent-Length: 160\r\nConnection: close\r\n\r\n<html>\r\n<head><title>404 Not Found</title></head>\r\n<body bgcolor=\"white\">\r\n<center><h1>404 Not Found</h1></center>\r\n<hr><center>proxy</center>\r\n</body>\r\n</html>";
 
-const std::string buffer::chunked_end{"0\r\n\r\n"};
-const int tcp_connection::CHUNK_SIZE = 1024;
-const int tcp_connection::BUFFER_SIZE = 16384;
+const size_t tcp_connection::READ_LIMIT = 1 << 18;
+const size_t tcp_connection::RELAY_THRESHOLD = 1 << 16;
+const size_t tcp_connection::PIPELINE_LIMIT = 1 << 16;
+const size_t tcp_connection::HIGH_WATERMARK = 1 << 18;
+const size_t tcp_connection::LOW_WATERMARK = 1 << 16;
 
-std::string get_field(std::string const& data, std::string const& field) {
-    size_t pos = data.find(field);
-    if (pos == std::string::npos) {
+// ETag of stored responce, only it's header is parsed
+static std::string get_etag(std::string const& responce) {
+    size_t end = responce.find("\r\n\r\n");
+    if (end == std::string::npos) {
         return "";
     }
-    pos = pos + field.size() + 1; //+ 1 - skip :
-    
-    while (data[pos] == ' ') pos++;
-    
-    std::string result{};
-    while (data[pos] != ' ' && data[pos] != '\n' && data[pos] != '\r') {
-        result += data[pos];
-        pos++;
-    }
-    return result;
-}
-
-buffer::buffer(std::string chunk) {
-    available_data = 0;
-    readed = 0;
-    tail = std::string();
-    data = chunk;
-}
-
-buffer::buffer(std::string chunk, int amount_of_data) {
-    available_data = amount_of_data;
-    readed = 0;
-    tail = std::string();
-    data = std::string();
-    append(chunk);
-}
-
-void buffer::append(std::string chunk) {
-    assert(available_data != 0);
-    
-    if (available_data != -1 && chunk.size() > available_data) {
-        chunk = chunk.substr(0, static_cast<unsigned>(available_data));
-    }
-    
-    if (chunk.size() > chunked_end.size()) {
-        tail = chunk.substr(chunk.size() - chunked_end.size());
-    } else {
-        tail += chunk;
-        if (tail.size() > chunked_end.size()) {
-            tail = tail.substr(tail.size() - chunked_end.size());
-        }
-    }
-    
-    if (available_data != -1) {
-        available_data -= chunk.size();
-    }
-    data += chunk;
-    
-    if (tail == chunked_end && available_data == -1) {
-        available_data = 0;
-    }
-}
-
-std::string buffer::get(size_t amount) const {
-    //amount == -1: return all data by default
-    if (amount == -1 || amount >= (data.size() - readed)) {
-        return data.substr(readed);
-    }
-    
-    return data.substr(readed, readed + amount);
-}
-
-void buffer::pop_front(size_t amount) {
-    assert(amount <= (data.size() - readed));
-    readed += amount;
+    http_header stored(responce.substr(0, end + 4));
+    return stored.get_field(http_header::Field::ETAG).to_string();
 }
 
-void buffer::clear() {
-    data.clear();
-    readed = 0;
-    available_data = 0;
-    tail.clear();
-}
-
-std::string buffer::get_all_data() {
-    return data;
-}
-
-size_t buffer::size() const {
-    return data.size() - readed;
-}
-
-tcp_connection::tcp_connection(event_queue* q, cache_type* responce_cache, cache_type* resolver_cache, int descriptor)
-    : queue(q), responce_cache(responce_cache), resolver_cache(resolver_cache), client(new proxy_client(descriptor)), server(nullptr)
+tcp_connection::tcp_connection(event_queue* q, cache_type* responce_cache, disk_cache* disk, dns_resolver* resolver, upstream_pool* pool, slab_pool* slabs, object_pool<proxy_client>* clients, connection_timeouts const* timeouts, int descriptor)
+    : clients(clients), client(clients->make(descriptor)), queue(q), responce_cache(responce_cache), disk(disk), resolver(resolver), pool(pool), slabs(slabs)
+    , timeouts(timeouts)
+    , idle_deadline(q->get_timers(), [this]() { safe_disconnect(); })
+    , header_deadline(q->get_timers(), [this]() { safe_disconnect(); })
+    , connect_deadline(q->get_timers(), [this]() { safe_disconnect(); })
+    , responce_deadline(q->get_timers(), [this]() { safe_disconnect(); })
+    , body_buffer(slabs)
 {
-    client_timer = std::move(
-                             event_registration {
-                                 queue,
-                                 client->get_socket(),
-                                 EVFILT_TIMER,
-                                 0,
-                                 NOTE_SECONDS,
-                                 600,
-                                 handler{
-                                     [this](struct kevent& event) {
-                                         std::cout << "TIMER";
-                                         safe_disconnect();
-                                     }
-                                 },
-                                 true
-                             }
-    );
+    idle_deadline.set(timeouts->idle);
 }
 
 void tcp_connection::start() {
     set_read_function(
                       client,
                       handler {
-                          [this](struct kevent& event) {
+                          [this](queue_event& event) {
                               handle_client_disconnect(event);
                           }
                       }
@@ -139,15 +55,14 @@ void tcp_connection::start() {
     switch_state(State::RECEIVE_CLIENT);
 }
 
-bool tcp_connection::init_server(std::string const& ip, std::string const& host, size_t port) {
-    //check if new server different to previous
-
+bool tcp_connection::init_server(int socket, std::string const& host) {
+    server_reusable = false;
     try {
-        server.reset(new proxy_client(ip, host, port));
+        server = clients->make(socket, host);
         set_read_function(
                           server,
                           handler {
-                              [this](struct kevent& event) {
+                              [this](queue_event& event) {
                                   handle_server_disconnect(event);
                               }
                           }
@@ -169,7 +84,11 @@ void tcp_connection::safe_server_disconnect() {
 }
 
 void tcp_connection::safe_client_disconnect() {
-    client_timer.invalidate();
+    //connection is finished without client
+    idle_deadline.cancel();
+    header_deadline.cancel();
+    connect_deadline.cancel();
+    responce_deadline.cancel();
     client.reset(nullptr);
 }
 
@@ -190,221 +109,583 @@ void tcp_connection::disconnect() {
     deleter();
 }
 
-void tcp_connection::get_client_body(struct kevent &event) {
-    if (handle_client_disconnect(event) || body_buffer.amount_of_available_data() == 0)
-        return;
+void tcp_connection::read_body(client_ptr& from, queue_event& event) {
+    //kernel could tell how much is waiting
+    if (event.data > 0) {
+        read_parts = static_cast<int>(std::min<size_t>(event.data / slab_pool::SLAB_SIZE + 1, buffer::MAX_PARTS));
+    }
+    
+    size_t total = 0;
+    while (total < READ_LIMIT && body_buffer.amount_of_available_data() != 0 && !is_over_watermark()) {
+        struct iovec parts[buffer::MAX_PARTS];
+        int count = body_buffer.prepare(parts, read_parts);
+        size_t asked = 0;
+        for (int i = 0; i < count; i++) {
+            asked += parts[i].iov_len;
+        }
+        
+        size_t len = from->read(parts, count);
+        body_buffer.commit(len);
+        total += len;
+        
+        if (len < asked) {
+            //socket is drained, less memory is prepared next time
+            if (len < asked / 2 && read_parts > 1) {
+                read_parts /= 2;
+            }
+            break;
+        }
+        if (read_parts < buffer::MAX_PARTS) {
+            read_parts *= 2;
+        }
+    }
+}
+
+bool tcp_connection::is_over_watermark() const {
+    size_t limit = slab_pool::is_over_limit() ? LOW_WATERMARK : HIGH_WATERMARK;
+    return body_buffer.size() >= limit;
+}
+
+void tcp_connection::throttle(client_ptr& from) {
+    if (!source_paused && from && body_buffer.amount_of_available_data() != 0 && is_over_watermark()) {
+        from->stop_read();
+        source_paused = true;
+    }
+}
+
+void tcp_connection::unthrottle(client_ptr& from) {
+    //over memory limit source waits until everything is sent
+    size_t limit = slab_pool::is_over_limit() ? 0 : LOW_WATERMARK;
+    if (source_paused && body_buffer.size() <= limit) {
+        source_paused = false;
+        if (from) {
+            from->resume_read();
+        }
+    }
+}
+
+void tcp_connection::read_header(client_ptr& from, http_header& to) {
+    //header is copied anyway, it's read to scratch memory first
+    char* scratch = slabs->scratch();
+    size_t total = 0;
+    while (to.get_state() != http_header::State::COMPLETE && total < READ_LIMIT) {
+        size_t len = from->read(scratch, slab_pool::SLAB_SIZE);
+        to.append(scratch, len);
+        total += len;
+        if (len < slab_pool::SLAB_SIZE) {
+            break;
+        }
+    }
+}
 
-    std::string chunk = client->read(CHUNK_SIZE);
-   
-//    std::cerr << "client body send " << client->get_socket() << ' ' << chunk << std::endl;
+void tcp_connection::get_client_body(queue_event& event) {
+    if (handle_client_disconnect(event))
+        return;
+    
+    if (relay.is_active() && state == State::SEND_SERVER) {
+        if (!relay_fill(client, server)) {
+            safe_disconnect();
+        }
+        return;
+    }
     
-    body_buffer.append(chunk);
+    if (state != State::SEND_SERVER || body_buffer.amount_of_available_data() == 0) {
+        //request is read, the following ones are read ahead
+        read_next_request();
+        return;
+    }
+
+    read_body(client, event);
+    if (body_buffer.is_broken()) {
+        safe_disconnect();
+        return;
+    }
+    //end of chunked body could come together with next request
+    next_header.append(body_buffer.take_overflow());
+    throttle(client);
 }
 
-void tcp_connection::get_client_header(struct kevent &event) {
+void tcp_connection::get_client_header(queue_event& event) {
     if (handle_client_disconnect(event)) {
 //        std::cout << "read client disconnect";
         return;
     }
 
-    std::string chunk = client->read(CHUNK_SIZE);
+    read_header(client, header);
 
-//    std::cerr << "client header send " << client->get_socket() << ' '  << chunk << std::endl;
-    header.append(chunk);
+    if (header.get_state() == http_header::State::COMPLETE) {
+        handle_request();
+    } else if (header.size() != 0 && !header_deadline.is_set()) {
+        header_deadline.set(timeouts->header);
+    }
+}
+
+void tcp_connection::read_next_request() {
+    //everything is taken, bytes after the next header belong to it's body or to requests after it
+    char* scratch = slabs->scratch();
+    next_header.append(scratch, client->read(scratch, slab_pool::SLAB_SIZE));
+    
+    if (next_header.size() + next_header.get_extra_data().size() >= PIPELINE_LIMIT) {
+        //the rest waits in socket until current responce is sent
+        client->stop_read();
+    }
+}
 
+void tcp_connection::next_request() {
+    switch_state(State::RECEIVE_CLIENT);
+    
+    //request could be already read ahead
     if (header.get_state() == http_header::State::COMPLETE) {
-        switch_state(State::RESOLVE);
+        handle_request();
+    } else if (client_closed) {
+        //nothing more will come from client
+        safe_disconnect();
+    } else if (header.size() != 0) {
+        header_deadline.set(timeouts->header);
+    }
+}
+
+void tcp_connection::handle_request() {
+    switch_state(State::RESOLVE);
+    
+    current_url = header.get_url();
+    responce_etag.clear();
+    
+    if (header.has_field(http_header::Field::IF_MATCH)
+        || header.has_field(http_header::Field::IF_MODIFIED_SINCE)
+        || header.has_field(http_header::Field::IF_NONE_MATCH)
+        || header.has_field(http_header::Field::IF_RANGE)
+        || header.has_field(http_header::Field::IF_UNMODIFIED_SINCE)) {
+        //client not interested in caching
+        current_url = "";
+    }
+    
+    //kept until responce, even if cache evicts it meanwhile
+    if (current_url.size() != 0) {
+        cached_responce = responce_cache->find(current_url);
+        if (!cached_responce && disk) {
+            disk_responce = disk->find(current_url);
+        }
+    }
+    if (cached_responce) {
+        header.add_line("If-None-Match", get_etag(*cached_responce));
+    } else if (disk_responce) {
+        header.add_line("If-None-Match", disk_responce->etag);
+    }
+    
+    std::string host = header.retrieve_host();
+    size_t port = header.retrieve_port();
+    // since we pass data as header + body
+    size_t content_len = header.get_content_length() + header.size();
+    
+    /*
+     resolving is done inside event loop,
+     during resolve connection couldn't die
+     but if we need to determine if connection is in valid state after resolve
+     we could check if deleted is true
+     */
+    auto resolved = [this, host, port, content_len](dns_resolver::result const& result) {
+        if (deleted) {
+            //if state is invalid just delete
+            disconnect();
+            return;
+        }
         
-        current_url = header.get_url();
+        if (result.status != dns_resolver::Status::OK) {
+            //canned page isn't responce for this url
+            current_url.clear();
+            responce_etag.clear();
+            close_after_responce = true;
+            body_buffer = buffer(slabs, BAD_REQUEST);
+            switch_state(State::SEND_CLIENT);
+            return;
+        }
         
-        if (header.has_field("If-Match")
-            || header.has_field("If-Modified-Since")
-            || header.has_field("If-None-Match")
-            || header.has_field("If-Range")
-            || header.has_field("If-Unmodified-Since")) {
-            //client not interested in caching
-            current_url = "";
+        connect_server(result.addresses, host, port, content_len);
+    };
+    
+    //cached names are answered right here
+    dns_resolver::result cached;
+    if (resolver->resolve_cached(host, cached)) {
+        resolved(cached);
+        return;
+    }
+    resolver->resolve(host, resolved);
+}
+
+void tcp_connection::connect_server(std::vector<std::string> const& addresses, std::string const& host, size_t port, size_t content_len) {
+    auto connected = [this, host, port, content_len](int socket, std::string const& ip) {
+        if (deleted) {
+            if (socket != -1) {
+                close(socket);
+            }
+            disconnect();
+            return;
         }
         
-        if (responce_cache->is_cached(current_url)) {
-            header.add_line("If-None-Match", get_field(responce_cache->get(current_url), "ETag"));
+        if (socket == -1 || !init_server(socket, host)) {
+            current_url.clear();
+            responce_etag.clear();
+            close_after_responce = true;
+            body_buffer = buffer(slabs, NOT_FOUND);
+            switch_state(State::SEND_CLIENT);
+            return;
         }
+        server_ip = ip;
+        server_port = port;
+        //here we have valid server and valid client
+        size_t readed = std::min(header.size() + header.get_extra_data().size(), content_len);
+        if (header.get_type() == http_header::Type::CHUNKED) {
+            body_buffer = buffer(slabs, header.get_string_representation(), -1);
+            body_buffer.decode_chunks();
+        } else if (start_relay(client, server, content_len - readed)) {
+            body_buffer = buffer(slabs, header.get_string_representation(), static_cast<int>(readed));
+        } else {
+            body_buffer = buffer(slabs, header.get_string_representation(), static_cast<int>(content_len));
+        }
+        body_buffer.append(header.get_extra_data());
+        //pipelined requests after this one
+        next_header.append(body_buffer.take_overflow());
         
-        task resolve {
-                [this]() {
-                    /*
-                     during resolve connection couldn't die
-                     but if we need to determine if connection is in valid state after resolve
-                     we could check if deleted is true
-                     */
-
-                    try {
-                        std::string host = header.retrieve_host();
-                        size_t port = header.retrieve_port();
-                        // since we pass data as header + body
-                        size_t content_len = header.get_content_length() + header.size();
-                        std::string ip;
-                        if (resolver_cache->is_cached(host)) {
-                            ip = resolver_cache->get(host);
-                        } else {
-                            ip = http_header::get_ip_by_host(host, port);
-                        }
-                        queue->execute_in_main(task{[this, host, ip, port, content_len](){
-                            if (deleted) {
-                                //if state is invalid just delete
-                                disconnect();
-                                return;
-                            }
-//                            std::cout << "RESOLVED " << client_s << std::endl;
-                            bool is_ok = init_server(ip, host, port);
-                            if (!is_ok) {
-                                body_buffer = buffer(NOT_FOUND, static_cast<int>(NOT_FOUND.size()));
-                                switch_state(State::SEND_CLIENT);
-                                return;
-                            }
-                            //if pair host-ip is ok, cache
-                            responce_cache->append(host, ip);
-                            
-                            //here we have valid server and valid client
-                            body_buffer = buffer(header.get_string_representation(), static_cast<int>(content_len));
-                            
-                            switch_state(State::SEND_SERVER);
-                        }});
-                        
-                    } catch (...) {
-                        if (deleted) {
-                            disconnect();
-                            return;
-                        }
-                        queue->execute_in_main(
-                                               task{[this]()
-                                                   {
-                                                       body_buffer = buffer(BAD_REQUEST, static_cast<int>(BAD_REQUEST.size()));
-                                                       switch_state(State::SEND_CLIENT);
-                                                       return;
-                                                   }
-                                               });
-                    }
-                }
-        };
-
-        //execute in background
-        queue->execute_in_background(resolve);
-    }
-}
-
-void tcp_connection::handle_client_write(struct kevent& event) {
-    if (handle_client_disconnect(event))
+        switch_state(State::SEND_SERVER);
+    };
+    
+    std::string ip;
+    int socket = pool->checkout(addresses, port, ip);
+    if (socket != -1) {
+        connected(socket, ip);
         return;
-
-    size_t len = client->send(body_buffer.get());
+    }
     
-//    std::cerr << "client receive " << client->get_socket() << ' ' << body_buffer.get() << std::endl;
+    // state is still RESOLVE, so connection couldn't die until callback
+    connector.reset(new upstream_connector(queue, addresses, port, connected));
+    connector->start();
+}
+
+void tcp_connection::release_server() {
+    if (server && server_reusable) {
+        pool->checkin(server->release(), server_ip, server_port);
+    }
+    server.reset(nullptr);
+}
+
+void tcp_connection::handle_client_write(queue_event& event) {
+    if (handle_client_disconnect(event))
+        return;
     
-    body_buffer.pop_front(len);
+    if (sending_from_disk) {
+        send_from_disk();
+        return;
+    }
+
+    if (body_buffer.size() != 0) {
+        struct iovec parts[buffer::MAX_PARTS];
+        body_buffer.pop_front(client->send(parts, body_buffer.get(parts, buffer::MAX_PARTS)));
+        unthrottle(server);
+    } else if (relay.is_active() && !relay_drain(server, client)) {
+        safe_disconnect();
+        return;
+    }
     
     //if server finish sending and client receive all available data
-    if (body_buffer.size() == 0 && body_buffer.amount_of_available_data() == 0) {
+    if (body_buffer.size() == 0 && body_buffer.amount_of_available_data() == 0 && !relay.is_active()) {
         client->stop_write();
-        if (current_url.size() != 0 && body_buffer.get_all_data().size() < BUFFER_SIZE) {
-            //cache responce
-            responce_cache->append(current_url, body_buffer.get_all_data());
+        if (close_after_responce) {
+            /*
+             body of failed request is never taken for the next request.
+             Client is closed after it stops sending, otherwise unread data resets connection with responce
+             */
+            ::shutdown(client->get_socket(), SHUT_WR);
+            set_read_function(
+                              client,
+                              handler {
+                                  [this](queue_event& event) {
+                                      discard_client(event);
+                                  }
+                              }
+                              );
+            header_deadline.set(timeouts->header);
+            return;
+        }
+        if (current_url.size() != 0) {
+            store_responce();
         }
-        switch_state(State::RECEIVE_CLIENT); //start new request
+        release_server();
+        next_request(); //start new request
     }
 }
 
-void tcp_connection::get_server_body(struct kevent &event) {
-    if (handle_server_disconnect(event) || body_buffer.amount_of_available_data() == 0)
+void tcp_connection::discard_client(queue_event& event) {
+    if (deleted) {
         return;
+    }
+    char* scratch = slabs->scratch();
+    if (client->read(scratch, slab_pool::SLAB_SIZE) == 0 && (event.flags & FLAG_EOF)) {
+        safe_disconnect();
+    }
+}
+
+void tcp_connection::send_from_disk() {
+    off_t end = disk_responce->offset + static_cast<off_t>(disk_responce->length);
+    if (disk_offset < end && !client->send_file(disk_responce->file->descriptor, disk_offset, static_cast<size_t>(end - disk_offset))) {
+        safe_disconnect();
+        return;
+    }
     
-    std::string chunk = server->read(CHUNK_SIZE);
+    if (disk_offset == end) {
+        client->stop_write();
+        release_server();
+        next_request(); //start new request
+    }
+}
+
+std::string tcp_connection::dechunk_responce() {
+    std::string const& raw = body_buffer.get_all_data();
+    std::string body;
+    if (raw.size() < header.size()) {
+        return raw;
+    }
+    chunk_decoder decoder;
+    decoder.feed(raw.data() + header.size(), raw.size() - header.size(), &body);
     
-//    std::cout << "server body send " << server->get_socket() << ' ' << chunk << std::endl;
+    header.remove_field(http_header::Field::TRANSFER_ENCODING);
+    header.add_line("Content-Length", std::to_string(body.size()));
+    return header.get_string_representation() + body;
+}
+
+void tcp_connection::store_responce() {
+    //responce wasn't kept, there is nothing to store
+    std::string const& kept = body_buffer.get_all_data();
+    if (kept.empty() || kept.size() < header.size()) {
+        return;
+    }
     
-    body_buffer.append(chunk);
+    std::shared_ptr<std::string> data;
+    if (header.get_type() == http_header::Type::CHUNKED) {
+        //stored with length, it's sent to clients in one piece anyway
+        data = std::make_shared<std::string>(dechunk_responce());
+    } else {
+        data = std::make_shared<std::string>(body_buffer.get_all_data());
+    }
+    
+    if (data->size() <= responce_cache->max_entry_weight()) {
+        //too large ones are rejected by cache anyway
+        responce_cache->append(current_url, data);
+    }
+    
+    if (disk && data->size() <= disk->max_object_size()) {
+        //disk is slow, write in background
+        disk_cache* current_disk = disk;
+        std::string url = current_url;
+        std::string etag = responce_etag;
+        queue->execute_in_background([current_disk, url, etag, data]() {
+            current_disk->append(url, etag, *data);
+        });
+    }
 }
 
-void tcp_connection::get_server_header(struct kevent &event) {
+void tcp_connection::get_server_body(queue_event& event) {
     if (handle_server_disconnect(event))
         return;
+    
+    if (relay.is_active() && state == State::SEND_CLIENT) {
+        if (!relay_fill(server, client)) {
+            safe_disconnect();
+        }
+        return;
+    }
+    
+    if (body_buffer.amount_of_available_data() == 0)
+        return;
+    
+    read_body(server, event);
+    if (body_buffer.is_broken()) {
+        safe_disconnect();
+        return;
+    }
+    throttle(server);
+}
 
-    std::string chunk = server->read(CHUNK_SIZE);
+void tcp_connection::get_server_header(queue_event& event) {
+    if (handle_server_disconnect(event))
+        return;
 
-//    std::cout << "server header send " << server->get_socket() << ' ' << chunk << std::endl;
-    header.append(chunk);
+    read_header(server, header);
 
     if (header.get_state() == http_header::State::COMPLETE) {
         /*
          Parse answer from server
          */
         
-        if (responce_cache->is_cached(current_url) && header.find_in_head("304")) {
-            body_buffer = buffer(responce_cache->get(current_url));
+        //responce without length is finished by closing connection
+        server_reusable = header.is_keep_alive()
+                          && (header.get_type() != http_header::Type::HEADER
+                              || header.get_status() == 304
+                              || header.get_status() == 204);
+        
+        if (cached_responce && header.get_status() == 304) {
+            body_buffer = buffer(slabs, *cached_responce);
+            //already cached
+            current_url.clear();
             switch_state(State::SEND_CLIENT);
             return;
         }
         
-        if (header.get_field("Cache-Control") == "private"
-            || header.get_field("Cache-Control") == "no-store"
-            || header.get_field("ETag") == "") {
-            //no caching
+        if (disk_responce && header.get_status() == 304) {
+            //file goes to client directly, without copying to memory
+            body_buffer = buffer(slabs);
+            sending_from_disk = true;
+            disk_offset = disk_responce->offset;
             current_url.clear();
+            switch_state(State::SEND_CLIENT);
+            return;
         }
         
+        responce_etag = header.get_field(http_header::Field::ETAG).to_string();
+        
+        if (header.has_token(http_header::Field::CACHE_CONTROL, "private")
+            || header.has_token(http_header::Field::CACHE_CONTROL, "no-store")
+            || responce_etag.empty()) {
+            //no caching
+            current_url.clear();
+        }
+
+        if (header.get_type() != http_header::Type::CHUNKED) {
+            //responce which no tier would take isn't kept in memory
+            size_t total = header.get_content_length() + header.size();
+            if (total > responce_cache->max_entry_weight() && (!disk || total > disk->max_object_size())) {
+                current_url.clear();
+            }
+        }
+
         if (header.get_type() == http_header::Type::CHUNKED) {
-            body_buffer = buffer(header.get_string_representation(), -1);
+            body_buffer = buffer(slabs, header.get_string_representation(), -1);
+            body_buffer.decode_chunks();
         } else {
-            body_buffer = buffer(header.get_string_representation(), static_cast<int>(header.get_content_length() + header.size()));
+            size_t total = header.get_content_length() + header.size();
+            size_t readed = std::min(header.size() + header.get_extra_data().size(), total);
+            //only responce that isn't cached could skip body_buffer
+            if (current_url.empty() && start_relay(server, client, total - readed)) {
+                body_buffer = buffer(slabs, header.get_string_representation(), static_cast<int>(readed));
+            } else {
+                body_buffer = buffer(slabs, header.get_string_representation(), static_cast<int>(total));
+            }
+        }
+        //body bytes which came together with header
+        body_buffer.append(header.get_extra_data());
+        
+        if (current_url.size() != 0) {
+            //sent slabs are released, cache needs the whole responce
+            body_buffer.keep_all_data();
         }
 
         switch_state(State::SEND_CLIENT);
     }
 }
 
-void tcp_connection::handle_server_write(struct kevent& event) {
+void tcp_connection::handle_server_write(queue_event& event) {
     if (handle_server_disconnect(event))
         return;
     
     
-    size_t len = server->send(body_buffer.get());
-    
-//    std::cout << "server receive " << server->get_socket() << ' ' << body_buffer.get(len) << std::endl;
-    body_buffer.pop_front(len);
+    if (body_buffer.size() != 0) {
+        struct iovec parts[buffer::MAX_PARTS];
+        body_buffer.pop_front(server->send(parts, body_buffer.get(parts, buffer::MAX_PARTS)));
+        unthrottle(client);
+    } else if (relay.is_active() && !relay_drain(client, server)) {
+        safe_disconnect();
+        return;
+    }
     
     //If we have already received all data from client and send it
-    if (body_buffer.size() == 0 && body_buffer.amount_of_available_data() == 0) {
+    if (body_buffer.size() == 0 && body_buffer.amount_of_available_data() == 0 && !relay.is_active()) {
         server->stop_write();
+        //following requests are read ahead, but not more than PIPELINE_LIMIT
+        if (!client_closed && next_header.size() + next_header.get_extra_data().size() < PIPELINE_LIMIT) {
+            client->resume_read();
+        }
         switch_state(State::RECEIVE_SERVER);
     }
 }
 
-bool tcp_connection::handle_server_disconnect(struct kevent& event) {
+bool tcp_connection::start_relay(client_ptr& from, client_ptr& to, size_t remaining) {
+    if (remaining <= RELAY_THRESHOLD || !splice_relay::is_supported()) {
+        return false;
+    }
+    return relay.start(from->get_socket(), to->get_socket(), remaining);
+}
+
+bool tcp_connection::relay_fill(client_ptr& from, client_ptr& to) {
+    if (!relay.fill()) {
+        return false;
+    }
+    if (!relay.is_pipe_empty()) {
+        to->resume_write();
+    }
+    //pipe is drained before source is read again
+    if (relay.is_read() || relay.is_pipe_full()) {
+        from->stop_read();
+    }
+    return true;
+}
+
+bool tcp_connection::relay_drain(client_ptr& from, client_ptr& to) {
+    if (!relay.drain()) {
+        return false;
+    }
+    if (from && !relay.is_read() && !relay.is_pipe_full()) {
+        from->resume_read();
+    }
+    if (relay.is_pipe_empty() && relay.is_active()) {
+        to->stop_write();
+    }
+    return true;
+}
+
+bool tcp_connection::handle_server_disconnect(queue_event& event) {
     if (deleted) {
         return true;
     }
-    client_timer.refresh();
+    idle_deadline.set(timeouts->idle);
     
-    if ((event.flags & EV_EOF) && (event.data == 0)) {
+    if ((event.flags & FLAG_EOF) && (event.data == 0)) {
         safe_server_disconnect();
         return true;
     }
     return false;
 }
 
-bool tcp_connection::handle_client_disconnect(struct kevent& event) {
+bool tcp_connection::handle_client_disconnect(queue_event& event) {
     if (deleted) {
         return true;
     }
-    client_timer.refresh();
+    idle_deadline.set(timeouts->idle);
     
-    if ((event.flags & EV_EOF) && (event.data == 0)) {
+    if ((event.flags & FLAG_EOF) && (event.data == 0)) {
+        if (event.filter == FILTER_READ && is_request_read()) {
+            //half-close, responces to requests which are already read are sent first
+            client_closed = true;
+            client->stop_read();
+            return true;
+        }
         safe_disconnect();
         return true;
     }
     return false;
 }
 
+bool tcp_connection::is_request_read() const {
+    switch (state) {
+        case State::SEND_SERVER:
+            return body_buffer.amount_of_available_data() == 0 && !relay.is_active();
+        case State::RECEIVE_SERVER:
+        case State::SEND_CLIENT:
+            return true;
+        default:
+            return false;
+    }
+}
+
 void tcp_connection::switch_state(State new_state) {
     state = new_state;
 //    std::cout << "switch_state: ";
@@ -432,32 +713,41 @@ void tcp_connection::switch_state(State new_state) {
     
     switch (new_state) {
         case State::RECEIVE_CLIENT:
-            header.clear();
+            //request read ahead becomes current
+            header = std::move(next_header);
+            next_header.clear();
             body_buffer.clear();
+            cached_responce.reset();
+            disk_responce.reset();
+            sending_from_disk = false;
             
             set_read_function(
                               client,
                               handler{
-                                  [this](struct kevent &event) {
+                                  [this](queue_event& event) {
                                       get_client_header(event);
                                   }
                               }
                               );
             break;
         case State::RESOLVE:
+            header_deadline.cancel();
+            connect_deadline.set(timeouts->connect);
             set_read_function(
                               client,
                               handler {
-                                  [this](struct kevent& event) {
+                                  [this](queue_event& event) {
                                       handle_client_disconnect(event);
                                   }
                               }
                               );
+            //it's unknown yet how much of following bytes is body, they wait in socket
+            client->stop_read();
             if (server) {
                 set_read_function(
                                   server,
                                   handler {
-                                      [this](struct kevent& event) {
+                                      [this](queue_event& event) {
                                           handle_server_disconnect(event);
                                       }
                                   }
@@ -465,10 +755,12 @@ void tcp_connection::switch_state(State new_state) {
             }
             break;
         case State::SEND_SERVER:
+            connect_deadline.cancel();
+            source_paused = false;
             set_write_function(
                                server,
                                handler{
-                                   [this](struct kevent &event) {
+                                   [this](queue_event& event) {
                                        handle_server_write(event);
                                    }
                                }
@@ -477,37 +769,41 @@ void tcp_connection::switch_state(State new_state) {
             set_read_function(
                               client,
                               handler{
-                                      [this](struct kevent &event) {
+                                      [this](queue_event& event) {
                                           get_client_body(event);
                                       }
                               }
             );
             break;
         case State::RECEIVE_SERVER:
+            responce_deadline.set(timeouts->responce);
             header.clear();
             body_buffer.clear();
             
             set_read_function(
                               server,
                               handler{
-                                  [this](struct kevent &event) {
+                                  [this](queue_event& event) {
                                       get_server_header(event);
                                   }
                               }
                               );
             break;
         case State::SEND_CLIENT:
+            connect_deadline.cancel();
+            responce_deadline.cancel();
+            source_paused = false;
             
             set_write_function(
                                client,
-                               [this](struct kevent &event) {
+                               [this](queue_event& event) {
                                    handle_client_write(event);
                                }
                                );
             
             set_read_function(
                               server,
-                              [this](struct kevent &event) {
+                              [this](queue_event& event) {
                                   get_server_body(event);
                               }
                               );
@@ -515,7 +811,7 @@ void tcp_connection::switch_state(State new_state) {
     }
 }
 
-void tcp_connection::set_read_function(std::unique_ptr<proxy_client>& object, handler hand) {
+void tcp_connection::set_read_function(client_ptr& object, handler hand) {
     if (!object) return;
     if (object->get_event_read().is_valid()) {
         object->get_event_read().change_function(std::move(hand));
@@ -524,7 +820,7 @@ void tcp_connection::set_read_function(std::unique_ptr<proxy_client>& object, ha
                            event_registration{
                                queue,
                                object->get_socket(),
-                               EVFILT_READ,
+                               FILTER_READ,
                                std::move(hand),
                            }
                            );
@@ -532,7 +828,7 @@ void tcp_connection::set_read_function(std::unique_ptr<proxy_client>& object, ha
     object->resume_read();
 }
 
-void tcp_connection::set_write_function(std::unique_ptr<proxy_client>& object, handler hand) {
+void tcp_connection::set_write_function(client_ptr& object, handler hand) {
     if (!object) return;
     if (object->get_event_write().is_valid()) {
         object->get_event_write().change_function(std::move(hand));
@@ -541,7 +837,7 @@ void tcp_connection::set_write_function(std::unique_ptr<proxy_client>& object, h
                                event_registration{
                                    queue,
                                    object->get_socket(),
-                                   EVFILT_WRITE,
+                                   FILTER_WRITE,
                                    std::move(hand)
                                }
                                );
@@ -22,76 +22,64 @@
 #include "proxy.hpp"
 #include "proxy_client.h"
 #include "lru_cache.hpp"
-
-struct buffer {
+#include "disk_cache.hpp"
+#include "dns_resolver.hpp"
+#include "upstream_connector.hpp"
+#include "upstream_pool.hpp"
+#include "splice_relay.hpp"
+#include "slab_buffer.hpp"
+#include "object_pool.hpp"
+#include "intrusive_list.hpp"
+#include "timing_wheel.hpp"
+#include "connection_timeouts.hpp"
+
+
+/*
+ connection is linked into list of connections of it's proxy,
+ it and it's sockets are taken from pools of the proxy
+ */
+struct tcp_connection : list_hook {
 private:
-    std::string data;
-    
-    /*
-     amount of data that server or client could add to body_buffer
-     0 means server or client finish reading data
-     -1 means chunked encoding(infinity)
-     */
-    int available_data = 0;
-    
+    using cache_type = lru_cache<std::string, std::string, string_entry_size>;
+    using client_ptr = object_pool<proxy_client>::pointer;
+    // at most this amount is read on one event, other connections shouldn't wait long
+    static const size_t READ_LIMIT;
+    // smaller bodies are copied, pipe isn't worth it
+    static const size_t RELAY_THRESHOLD;
+    // how much of pipelined requests is read ahead
+    static const size_t PIPELINE_LIMIT;
     /*
-     pointer to the last readed char
+     source of body isn't read while more than HIGH_WATERMARK isn't sent,
+     it's read again below LOW_WATERMARK. Over memory limit LOW_WATERMARK is the high one
      */
-    mutable size_t readed = 0;
-    
-    /*
-     stores last bytes to determine end of chunked data
-     */
-    std::string tail;
-    
-    static const std::string chunked_end;
-    
-public:
-    buffer() {};
-    buffer(std::string);
-    buffer(std::string, int amount_of_data);
-    
-    buffer(buffer const&) = delete;
-    buffer& operator=(buffer const&) = delete;
-    
-    buffer(buffer&&) = default;
-    buffer& operator=(buffer&&) = default;
-    
-    int amount_of_available_data() const {
-        return available_data;
-    }
-    
-    void append(std::string chunk);
-    
-    std::string get(size_t amount = -1) const;
-    
-    void pop_front(size_t amount);
-    
-    void clear();
-    
-    std::string get_all_data();
-    
-    size_t size() const;
-};
-
-
-struct tcp_connection {
-private:
-    using cache_type = lru_cache<std::string, std::string>;
-    static const int CHUNK_SIZE;
-    static const int BUFFER_SIZE;
+    static const size_t HIGH_WATERMARK;
+    static const size_t LOW_WATERMARK;
 
     enum class State {RECEIVE_CLIENT, RESOLVE, SEND_SERVER, RECEIVE_SERVER, SEND_CLIENT};
 
     State state;
     
-    std::unique_ptr<proxy_client> client;
-    std::unique_ptr<proxy_client> server;
+    // memory for client and server, declared before them
+    object_pool<proxy_client>* clients;
+    client_ptr client;
+    client_ptr server;
     event_queue* queue;
     cache_type* responce_cache;
-    cache_type* resolver_cache;
-    
-    event_registration client_timer;
+    // nullptr if there is no disk tier
+    disk_cache* disk;
+    dns_resolver* resolver;
+    upstream_pool* pool;
+    // memory for body_buffer, shared by connections of one reactor
+    slab_pool* slabs;
+    
+    // establishes connection to server, replaced on every request
+    std::unique_ptr<upstream_connector> connector;
+    
+    connection_timeouts const* timeouts;
+    deadline idle_deadline;
+    deadline header_deadline;
+    deadline connect_deadline;
+    deadline responce_deadline;
     
     /*
      callback to proxy server
@@ -105,6 +93,9 @@ private:
      */
     http_header header;
     
+    // next pipelined request, it's read while current one is handled
+    http_header next_header;
+    
     /*
      buffer used for simultaneous transfer of data
      between server and client
@@ -112,33 +103,95 @@ private:
     buffer body_buffer;
     
     std::string current_url;
+    // cached responce for current_url, if any
+    std::shared_ptr<const std::string> cached_responce;
+    // responce for current_url stored on disk, used if there is nothing in memory
+    std::shared_ptr<const disk_cache::entry> disk_responce;
+    // true while disk_responce is sent to client
+    bool sending_from_disk = false;
+    off_t disk_offset = 0;
+    // ETag of current server responce
+    std::string responce_etag;
     
-    bool deleted = false;
+    /*
+     body which isn't cached (responce) or isn't needed at all (request)
+     goes socket to socket, after the part already read with header is sent
+     */
+    splice_relay relay;
     
-    bool init_server(std::string const& ip, std::string const& host, size_t port);
+    // address of server, connection goes back to pool by it
+    std::string server_ip;
+    size_t server_port = 0;
+    // server could be reused after responce is sent to client
+    bool server_reusable = false;
+    
+    bool deleted = false;
+    // client finished sending (half-close), it's closed when responces to read requests are sent
+    bool client_closed = false;
+    // responce to failed request says "Connection: close", request body isn't read
+    bool close_after_responce = false;
+    
+    bool init_server(int socket, std::string const& host);
+    void connect_server(std::vector<std::string> const& addresses, std::string const& host, size_t port, size_t content_len);
+    // returns server to pool if it's possible, closes otherwise
+    void release_server();
     //always be sure to call this ONLY in main thread
     void switch_state(State new_state);
 
-    void get_client_body(struct kevent &event);
-    void get_client_header(struct kevent &event);
-
-    void get_server_body(struct kevent &event);
-    void get_server_header(struct kevent &event);
-
-    void handle_client_write(struct kevent& event);
-    void handle_server_write(struct kevent& event);
-
-    bool handle_server_disconnect(struct kevent& event);
-    bool handle_client_disconnect(struct kevent& event);
-    
-    void set_read_function(std::unique_ptr<proxy_client>&, handler);
-    void set_write_function(std::unique_ptr<proxy_client>&, handler);
+    // number of slabs for the next read, grows while socket fills all of them
+    int read_parts = 2;
+    
+    // source of body_buffer isn't read until destination takes enough
+    bool source_paused = false;
+    bool is_over_watermark() const;
+    void throttle(client_ptr& from);
+    void unthrottle(client_ptr& from);
+    
+    // reads body until socket is drained or READ_LIMIT is reached
+    void read_body(client_ptr& from, queue_event& event);
+    // reads header until it's complete or socket is drained
+    void read_header(client_ptr& from, http_header& to);
+    
+    void get_client_body(queue_event& event);
+    void get_client_header(queue_event& event);
+    void read_next_request();
+    // takes next request, it's handled at once if it's already read
+    void next_request();
+    void handle_request();
+
+    void get_server_body(queue_event& event);
+    void get_server_header(queue_event& event);
+
+    void handle_client_write(queue_event& event);
+    // drops everything client sends until it closes connection
+    void discard_client(queue_event& event);
+    void send_from_disk();
+    
+    // source socket is readable, returns false if relay failed
+    bool relay_fill(client_ptr& from, client_ptr& to);
+    // destination socket is writable, returns false if relay failed
+    bool relay_drain(client_ptr& from, client_ptr& to);
+    // starts relay of the rest of body, returns false if it's too small or relay isn't supported
+    bool start_relay(client_ptr& from, client_ptr& to, size_t remaining);
+    // chunked responce from body_buffer with body in one piece
+    std::string dechunk_responce();
+    // puts responce to both memory and disk tiers
+    void store_responce();
+    void handle_server_write(queue_event& event);
+
+    bool handle_server_disconnect(queue_event& event);
+    bool handle_client_disconnect(queue_event& event);
+    // request is read completely, responce to it is still expected
+    bool is_request_read() const;
+    
+    void set_read_function(client_ptr&, handler);
+    void set_write_function(client_ptr&, handler);
     
     void disconnect();
 
 public:
     //Don't forget to set callback and deleter after constructor
-    tcp_connection(event_queue* queue, cache_type* responce_cache, cache_type* resolver_cache, int descriptor);
+    tcp_connection(event_queue* queue, cache_type* responce_cache, disk_cache* disk, dns_resolver* resolver, upstream_pool* pool, slab_pool* slabs, object_pool<proxy_client>* clients, connection_timeouts const* timeouts, int descriptor);
     
     ~tcp_connection();
 
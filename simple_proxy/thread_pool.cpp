@@ -0,0 +1,199 @@
+//
+//  thread_pool.cpp
+//  simple_proxy
+//
+
+#include <signal.h>
+#include <algorithm>
+#include "thread_pool.hpp"
+
+const size_t thread_pool::HISTOGRAM_SIZE;
+const std::chrono::microseconds thread_pool::GROW_THRESHOLD{2000};
+const std::chrono::seconds thread_pool::IDLE_TIMEOUT{10};
+
+thread_pool::thread_pool(size_t min_threads, size_t max_threads)
+    : min_threads(std::max<size_t>(min_threads, 1))
+    , max_threads(std::max(max_threads, this->min_threads))
+    , workers(new worker[this->max_threads])
+{
+    for (auto& bucket: histogram) {
+        bucket = 0;
+    }
+
+    std::lock_guard<std::mutex> lock(resize_mutex);
+    for (size_t i = 0; i < this->min_threads; i++) {
+        start_worker();
+    }
+}
+
+thread_pool::~thread_pool() {
+    stop();
+}
+
+bool thread_pool::start_worker() {
+    if (!work || threads >= max_threads) {
+        return false;
+    }
+
+    for (size_t i = 0; i < max_threads; i++) {
+        worker& current = workers[i];
+        if (current.active) {
+            continue;
+        }
+        // previous thread of this slot has already retired
+        if (current.thread.joinable()) {
+            current.thread.join();
+        }
+        current.active = true;
+        threads++;
+        current.thread = std::thread(
+                                     [this, i]() {
+                                         execute(i);
+                                     }
+                         );
+        return true;
+    }
+    return false;
+}
+
+void thread_pool::push(background_task t) {
+    // counted before it's visible, so sleeping workers never miss it
+    queued++;
+    
+    size_t start = next++;
+    for (size_t i = 0; i < max_threads; i++) {
+        worker& current = workers[(start + i) % max_threads];
+        if (current.active || i + 1 == max_threads) {
+            // even if nobody is active, stealing workers will find it
+            std::lock_guard<std::mutex> lock(current.mutex);
+            current.tasks.push_back(item{std::move(t), clock::now()});
+            break;
+        }
+    }
+
+    if (sleeping > 0) {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        condition.notify_one();
+    }
+}
+
+bool thread_pool::pop(size_t index, item& result) {
+    {
+        //own tasks in FIFO order
+        worker& own = workers[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (own.tasks.size() != 0) {
+            result = std::move(own.tasks.front());
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < max_threads; i++) {
+        //steal from the back of others
+        worker& victim = workers[(index + i) % max_threads];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.tasks.size() != 0) {
+            result = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void thread_pool::account_wait(clock::duration wait) {
+    int64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(wait).count();
+
+    size_t bucket = 0;
+    while (bucket + 1 < HISTOGRAM_SIZE && (int64_t(1) << bucket) <= micros) {
+        bucket++;
+    }
+    histogram[bucket]++;
+
+    //not exact under concurrent updates, but good enough for resizing
+    int64_t average = average_wait.load(std::memory_order_relaxed);
+    average_wait.store(average + (micros - average) / 8, std::memory_order_relaxed);
+}
+
+void thread_pool::execute(size_t index) {
+    // signals are handled by event loop thread only
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+    worker& own = workers[index];
+    auto idle_since = clock::now();
+
+    while (work) {
+        item current;
+        if (pop(index, current)) {
+            queued--;
+            running++;
+            account_wait(clock::now() - current.pushed);
+
+            if (average_wait.load(std::memory_order_relaxed) > GROW_THRESHOLD.count() && queued > 0 && running == threads) {
+                //everybody is busy and tasks wait too long
+                std::lock_guard<std::mutex> lock(resize_mutex);
+                start_worker();
+            }
+
+            current.t();
+            running--;
+            completed++;
+            idle_since = clock::now();
+            continue;
+        }
+
+        if (clock::now() - idle_since >= IDLE_TIMEOUT) {
+            std::lock_guard<std::mutex> lock(resize_mutex);
+            if (threads > min_threads) {
+                std::lock_guard<std::mutex> own_lock(own.mutex);
+                if (own.tasks.size() == 0) {
+                    threads--;
+                    own.active = false;
+                    return;
+                }
+            }
+            idle_since = clock::now();
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        sleeping++;
+        condition.wait_for(lock, IDLE_TIMEOUT, [this]() {
+            return !work || queued > 0;
+        });
+        sleeping--;
+    }
+}
+
+void thread_pool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        work = false;
+        condition.notify_all();
+    }
+
+    {
+        // wait for start_worker in progress, no new workers after that
+        std::lock_guard<std::mutex> lock(resize_mutex);
+    }
+    
+    for (size_t i = 0; i < max_threads; i++) {
+        if (workers[i].thread.joinable()) {
+            workers[i].thread.join();
+        }
+    }
+}
+
+thread_pool::statistics thread_pool::get_statistics() const {
+    statistics result;
+    result.threads = threads;
+    result.queued = queued;
+    result.running = running;
+    result.completed = completed;
+    for (size_t i = 0; i < HISTOGRAM_SIZE; i++) {
+        result.wait_histogram[i] = histogram[i];
+    }
+    return result;
+}
@@ -0,0 +1,141 @@
+//
+//  thread_pool.hpp
+//  simple_proxy
+//
+
+#ifndef thread_pool_hpp
+#define thread_pool_hpp
+
+#include <stdio.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+/*
+ move-only analogue of std::function<void()>
+ */
+struct background_task {
+    background_task() {}
+
+    template<typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, background_task>::value>::type>
+    background_task(F f)
+        : impl(new model<F>(std::move(f)))
+    {}
+
+    background_task(background_task const&) = delete;
+    background_task& operator=(background_task const&) = delete;
+
+    background_task(background_task&&) = default;
+    background_task& operator=(background_task&&) = default;
+
+    void operator()() {
+        impl->call();
+    }
+
+    explicit operator bool() const {
+        return impl != nullptr;
+    }
+private:
+    struct callable {
+        virtual ~callable() {}
+        virtual void call() = 0;
+    };
+
+    template<typename F>
+    struct model : callable {
+        model(F f): f(std::move(f)) {}
+
+        void call() override {
+            f();
+        }
+
+        F f;
+    };
+
+    std::unique_ptr<callable> impl;
+};
+
+/*
+ work-stealing pool: every worker has it's own deque,
+ tasks are distributed round-robin and idle workers steal from others.
+ Pool grows while tasks wait in queues too long and shrinks back
+ to min_threads when workers stay idle
+ */
+struct thread_pool {
+    static const size_t HISTOGRAM_SIZE = 16;
+
+    struct statistics {
+        size_t threads;
+        size_t queued;
+        size_t running;
+        size_t completed;
+        // i-th bucket: tasks waited less than 2^i microseconds, last bucket: all the rest
+        std::array<size_t, HISTOGRAM_SIZE> wait_histogram;
+    };
+
+    thread_pool(size_t min_threads, size_t max_threads);
+    ~thread_pool();
+
+    thread_pool(thread_pool const&) = delete;
+    thread_pool& operator=(thread_pool const&) = delete;
+
+    // could be called from any thread
+    void push(background_task t);
+
+    void stop();
+
+    statistics get_statistics() const;
+private:
+    using clock = std::chrono::steady_clock;
+
+    static const std::chrono::microseconds GROW_THRESHOLD;
+    static const std::chrono::seconds IDLE_TIMEOUT;
+
+    struct item {
+        background_task t;
+        clock::time_point pushed;
+    };
+
+    struct worker {
+        std::mutex mutex;
+        std::deque<item> tasks;
+        std::thread thread;
+        std::atomic<bool> active{false};
+    };
+
+    size_t min_threads;
+    size_t max_threads;
+    std::unique_ptr<worker[]> workers;
+
+    std::atomic<bool> work{true};
+    std::atomic<size_t> threads{0};
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> running{0};
+    std::atomic<size_t> completed{0};
+    std::atomic<size_t> sleeping{0};
+    // exponential moving average of wait time, microseconds
+    std::atomic<int64_t> average_wait{0};
+    std::array<std::atomic<size_t>, HISTOGRAM_SIZE> histogram;
+
+    std::mutex sleep_mutex;
+    std::condition_variable condition;
+    std::mutex resize_mutex;
+
+    // resize_mutex should be locked
+    bool start_worker();
+
+    bool pop(size_t index, item& result);
+
+    void execute(size_t index);
+
+    void account_wait(clock::duration wait);
+};
+
+#endif /* thread_pool_hpp */
@@ -0,0 +1,126 @@
+//
+//  timing_wheel.cpp
+//  simple_proxy
+//
+
+#include "timing_wheel.hpp"
+
+#include <algorithm>
+
+const int timing_wheel::TICK = 10;
+const uint64_t timing_wheel::SLOTS;
+
+deadline::deadline(timing_wheel* wheel, std::function<void()> callback)
+    : wheel(wheel)
+    , callback(std::move(callback))
+{}
+
+deadline::~deadline() {
+    cancel();
+}
+
+void deadline::set(int milliseconds) {
+    wheel->add(this, milliseconds);
+}
+
+void deadline::cancel() {
+    if (is_set()) {
+        wheel->remove(this);
+    }
+}
+
+timing_wheel::timing_wheel()
+    : start(clock::now())
+{}
+
+uint64_t timing_wheel::now() const {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start).count());
+}
+
+void timing_wheel::add(deadline* timer, int milliseconds) {
+    if (timer->is_set()) {
+        remove(timer);
+    }
+    //never earlier than asked, never in tick which is already processed
+    uint64_t expires = (now() + static_cast<uint64_t>(std::max(milliseconds, 0)) + TICK - 1) / TICK;
+    timer->expires = std::max(expires, current + 1);
+    place(timer);
+    count++;
+}
+
+void timing_wheel::remove(deadline* timer) {
+    timer->slot->erase(timer);
+    timer->slot = nullptr;
+    count--;
+}
+
+void timing_wheel::place(deadline* timer) {
+    uint64_t delta = timer->expires > current ? timer->expires - current : 0;
+
+    int level = 0;
+    while (level + 1 < LEVELS && delta >= (uint64_t(1) << (LEVEL_BITS * (level + 1)))) {
+        level++;
+    }
+    //too far ones wait at the top level, they're moved again when it wraps around
+    uint64_t expires = timer->expires;
+    uint64_t range = uint64_t(1) << (LEVEL_BITS * LEVELS);
+    if (delta >= range) {
+        expires = current + range - 1;
+    }
+
+    timer->slot = &slots[level][(expires >> (LEVEL_BITS * level)) & (SLOTS - 1)];
+    timer->slot->push_back(timer);
+}
+
+void timing_wheel::cascade() {
+    for (int level = 1; level < LEVELS; level++) {
+        uint64_t index = (current >> (LEVEL_BITS * level)) & (SLOTS - 1);
+        intrusive_list<deadline>& slot = slots[level][index];
+        while (!slot.empty()) {
+            deadline* timer = slot.front();
+            slot.erase(timer);
+            place(timer);
+        }
+        if (index != 0) {
+            break;
+        }
+    }
+}
+
+int timing_wheel::next_timeout() const {
+    if (count == 0) {
+        return -1;
+    }
+    //first non-empty slot of the lowest level, or the moment when upper ones move down
+    uint64_t tick = current + 1;
+    while ((tick & (SLOTS - 1)) != 0 && slots[0][tick & (SLOTS - 1)].empty()) {
+        tick++;
+    }
+    uint64_t elapsed = now();
+    uint64_t moment = tick * TICK;
+    return moment > elapsed ? static_cast<int>(moment - elapsed) : 0;
+}
+
+void timing_wheel::advance() {
+    uint64_t target = now() / TICK;
+    if (count == 0) {
+        current = std::max(current, target);
+        return;
+    }
+
+    while (current < target && count != 0) {
+        current++;
+        if ((current & (SLOTS - 1)) == 0) {
+            cascade();
+        }
+
+        //callback could set or cancel any deadline, including itself
+        intrusive_list<deadline>& slot = slots[0][current & (SLOTS - 1)];
+        while (!slot.empty()) {
+            deadline* timer = slot.front();
+            remove(timer);
+            timer->callback();
+        }
+    }
+    current = std::max(current, target);
+}
@@ -0,0 +1,96 @@
+//
+//  timing_wheel.hpp
+//  simple_proxy
+//
+
+#ifndef timing_wheel_hpp
+#define timing_wheel_hpp
+
+#include <stdio.h>
+#include <cstdint>
+#include <chrono>
+#include <functional>
+
+#include "intrusive_list.hpp"
+
+struct timing_wheel;
+
+/*
+ callback which is called once, when it's time comes.
+ Setting it again only moves it inside the wheel, kernel isn't involved
+ */
+struct deadline : list_hook {
+    deadline() {}
+    deadline(timing_wheel* wheel, std::function<void()> callback);
+    ~deadline();
+
+    deadline(deadline const&) = delete;
+    deadline& operator=(deadline const&) = delete;
+
+    // callback is called after milliseconds, previous setting is forgotten
+    void set(int milliseconds);
+    void cancel();
+
+    bool is_set() const {
+        return is_linked();
+    }
+
+private:
+    friend struct timing_wheel;
+
+    timing_wheel* wheel = nullptr;
+    std::function<void()> callback;
+    // tick when it expires and slot where it waits for it
+    uint64_t expires = 0;
+    intrusive_list<deadline>* slot = nullptr;
+};
+
+/*
+ hierarchical timing wheel: LEVELS wheels of SLOTS slots,
+ slot of level i covers SLOTS^i ticks.
+ Adding and removing deadline is O(1), deadlines from upper levels
+ are moved down when lower level wraps around.
+ Time goes on only in advance(), one per event_queue, not thread-safe
+ */
+struct timing_wheel {
+    static const int TICK; // milliseconds
+
+    timing_wheel();
+
+    timing_wheel(timing_wheel const&) = delete;
+    timing_wheel& operator=(timing_wheel const&) = delete;
+
+    void add(deadline* timer, int milliseconds);
+    void remove(deadline* timer);
+
+    // how long poll could sleep (milliseconds), -1 if there is nothing to wait for
+    int next_timeout() const;
+
+    // calls callbacks of expired deadlines
+    void advance();
+
+    size_t size() const {
+        return count;
+    }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    static const int LEVEL_BITS = 6;
+    static const uint64_t SLOTS = 1 << LEVEL_BITS;
+    static const int LEVELS = 4;
+
+    clock::time_point start;
+    // every tick up to this one is processed
+    uint64_t current = 0;
+    size_t count = 0;
+
+    intrusive_list<deadline> slots[LEVELS][SLOTS];
+
+    // milliseconds since start
+    uint64_t now() const;
+    void place(deadline* timer);
+    void cascade();
+};
+
+#endif /* timing_wheel_hpp */
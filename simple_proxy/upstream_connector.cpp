@@ -0,0 +1,182 @@
+//
+//  upstream_connector.cpp
+//  simple_proxy
+//
+
+#include "upstream_connector.hpp"
+#include "socket.hpp"
+
+#include <cstring>
+#include <errno.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <algorithm>
+
+const int upstream_connector::ATTEMPT_DELAY = 250;
+const int upstream_connector::CONNECT_TIMEOUT = 10 * 1000;
+
+static bool make_address(std::string const& ip, size_t port, struct sockaddr_storage& result) {
+    std::memset(&result, 0, sizeof(result));
+
+    auto& v4 = reinterpret_cast<struct sockaddr_in&>(result);
+    if (inet_pton(AF_INET, ip.c_str(), &v4.sin_addr) == 1) {
+        v4.sin_family = AF_INET;
+        v4.sin_port = htons(static_cast<uint16_t>(port));
+        return true;
+    }
+
+    auto& v6 = reinterpret_cast<struct sockaddr_in6&>(result);
+    if (inet_pton(AF_INET6, ip.c_str(), &v6.sin6_addr) == 1) {
+        v6.sin6_family = AF_INET6;
+        v6.sin6_port = htons(static_cast<uint16_t>(port));
+        return true;
+    }
+    return false;
+}
+
+upstream_connector::upstream_connector(event_queue* queue, std::vector<std::string> const& addresses, size_t port, callback cb)
+    : queue(queue), cb(std::move(cb))
+{
+    std::vector<candidate> ipv4;
+    std::vector<candidate> ipv6;
+    for (auto& ip: addresses) {
+        candidate current;
+        if (!make_address(ip, port, current.address)) {
+            continue;
+        }
+        current.ip = ip;
+        (current.address.ss_family == AF_INET6 ? ipv6 : ipv4).push_back(current);
+    }
+
+    //interleave families, IPv6 first
+    for (size_t i = 0; i < std::max(ipv4.size(), ipv6.size()); i++) {
+        if (i < ipv6.size()) {
+            candidates.push_back(ipv6[i]);
+        }
+        if (i < ipv4.size()) {
+            candidates.push_back(ipv4[i]);
+        }
+    }
+
+    timer = event_registration{queue, queue->make_timer_ident(), FILTER_TIMER, 0, ATTEMPT_DELAY, [this](queue_event& event) {
+        on_timer();
+    }};
+}
+
+upstream_connector::~upstream_connector() {
+    timer.invalidate();
+    for (auto& a: attempts) {
+        close_attempt(a);
+    }
+}
+
+void upstream_connector::start() {
+    deadline = clock::now() + std::chrono::milliseconds(CONNECT_TIMEOUT);
+    start_next();
+}
+
+void upstream_connector::start_next() {
+    while (next < candidates.size()) {
+        candidate& current = candidates[next++];
+
+        int s = ::socket(current.address.ss_family, SOCK_STREAM, 0);
+        try {
+            set_socket_properties(s);
+        } catch (...) {
+            if (s != -1) {
+                close(s);
+            }
+            continue;
+        }
+
+        socklen_t size = current.address.ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+        if (::connect(s, reinterpret_cast<struct sockaddr*>(&current.address), size) == 0) {
+            finish(s, current.ip);
+            return;
+        }
+        if (errno != EINPROGRESS) {
+            //unreachable family or network, don't wait for it
+            close(s);
+            continue;
+        }
+
+        attempts.emplace_back();
+        attempt& a = attempts.back();
+        a.socket = s;
+        a.ip = current.ip;
+        //connection is established (or failed) when socket becomes writable
+        a.write = event_registration{queue, s, FILTER_WRITE, [this, &a](queue_event& event) {
+            on_write(a);
+        }, true};
+
+        //give this attempt ATTEMPT_DELAY before the next one
+        timer.refresh();
+        return;
+    }
+
+    for (auto& a: attempts) {
+        if (a.socket != -1) {
+            //still waiting for somebody
+            return;
+        }
+    }
+    finish(-1, "");
+}
+
+void upstream_connector::on_write(attempt& a) {
+    if (done || a.socket == -1) {
+        return;
+    }
+
+    int error = 0;
+    socklen_t size = sizeof(error);
+    if (getsockopt(a.socket, SOL_SOCKET, SO_ERROR, &error, &size) == -1) {
+        error = errno;
+    }
+
+    if (error == 0) {
+        int s = a.socket;
+        a.socket = -1;
+        a.write.invalidate();
+        finish(s, a.ip);
+        return;
+    }
+
+    close_attempt(a);
+    start_next();
+}
+
+void upstream_connector::on_timer() {
+    if (done) {
+        return;
+    }
+
+    if (clock::now() >= deadline) {
+        finish(-1, "");
+        return;
+    }
+
+    if (next < candidates.size()) {
+        start_next();
+    }
+}
+
+void upstream_connector::close_attempt(attempt& a) {
+    a.write.invalidate();
+    if (a.socket != -1) {
+        close(a.socket);
+        a.socket = -1;
+    }
+}
+
+void upstream_connector::finish(int socket, std::string const& ip) {
+    done = true;
+    timer.invalidate();
+    for (auto& a: attempts) {
+        close_attempt(a);
+    }
+
+    callback current = std::move(cb);
+    current(socket, ip);
+}
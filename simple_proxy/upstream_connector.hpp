@@ -0,0 +1,78 @@
+//
+//  upstream_connector.hpp
+//  simple_proxy
+//
+
+#ifndef upstream_connector_hpp
+#define upstream_connector_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <chrono>
+#include <functional>
+#include <sys/socket.h>
+
+#include "event_queue.hpp"
+#include "event_registration.h"
+
+/*
+ non-blocking connect to one of resolved addresses, happy eyeballs style (RFC 8305):
+ IPv6 and IPv4 addresses are interleaved, next attempt starts as soon as
+ previous one failed or ATTEMPT_DELAY passed without answer.
+ First established connection wins, all the others are closed
+ */
+struct upstream_connector {
+    // socket is -1 if every address failed or CONNECT_TIMEOUT expired
+    using callback = std::function<void(int socket, std::string const& ip)>;
+
+    upstream_connector(event_queue* queue, std::vector<std::string> const& addresses, size_t port, callback cb);
+    ~upstream_connector();
+
+    upstream_connector(upstream_connector const&) = delete;
+    upstream_connector& operator=(upstream_connector const&) = delete;
+
+    /*
+     callback could be invoked right from start
+     if connection is established (or failed) immediately
+     */
+    void start();
+private:
+    using clock = std::chrono::steady_clock;
+
+    static const int ATTEMPT_DELAY; // milliseconds
+    static const int CONNECT_TIMEOUT; // milliseconds
+
+    struct candidate {
+        struct sockaddr_storage address;
+        std::string ip;
+    };
+
+    struct attempt {
+        // -1 when attempt is over
+        int socket = -1;
+        std::string ip;
+        event_registration write;
+    };
+
+    event_queue* queue;
+    callback cb;
+
+    std::vector<candidate> candidates;
+    size_t next = 0;
+    // list keeps attempts in place, handlers refer to them
+    std::list<attempt> attempts;
+
+    event_registration timer;
+    clock::time_point deadline;
+    bool done = false;
+
+    void start_next();
+    void on_write(attempt& a);
+    void on_timer();
+    void finish(int socket, std::string const& ip);
+    void close_attempt(attempt& a);
+};
+
+#endif /* upstream_connector_hpp */
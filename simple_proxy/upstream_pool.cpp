@@ -0,0 +1,151 @@
+//
+//  upstream_pool.cpp
+//  simple_proxy
+//
+
+#include "upstream_pool.hpp"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+const size_t upstream_pool::MAX_IDLE_PER_HOST = 8;
+const size_t upstream_pool::MAX_IDLE = 256;
+const std::chrono::seconds upstream_pool::IDLE_TIMEOUT{30};
+const int upstream_pool::SWEEP_PERIOD = 1000;
+
+upstream_pool::upstream_pool(event_queue* queue)
+    : queue(queue)
+{
+    timer = event_registration{queue, queue->make_timer_ident(), FILTER_TIMER, 0, SWEEP_PERIOD, [this](queue_event& event) {
+        on_timer();
+    }};
+}
+
+upstream_pool::~upstream_pool() {
+    timer.invalidate();
+    for (auto& host: connections) {
+        for (auto& connection: host.second) {
+            connection->read.invalidate();
+            close(connection->socket);
+        }
+    }
+}
+
+bool upstream_pool::is_alive(int socket) {
+    char c;
+    ssize_t result = recv(socket, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    // nothing to read is the only good answer: 0 is EOF, data is unexpected
+    return result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+int upstream_pool::checkout(std::vector<std::string> const& addresses, size_t port, std::string& ip) {
+    dropped.clear();
+
+    for (auto& address: addresses) {
+        auto it = connections.find(key(address, port));
+        while (it != connections.end() && it->second.size() != 0) {
+            std::unique_ptr<idle> connection = std::move(it->second.back());
+            it->second.pop_back();
+            idle_count--;
+
+            connection->read.invalidate();
+            if (!is_alive(connection->socket)) {
+                close(connection->socket);
+                continue;
+            }
+
+            if (it->second.size() == 0) {
+                connections.erase(it);
+            }
+            reused_count++;
+            ip = address;
+            return connection->socket;
+        }
+        if (it != connections.end()) {
+            connections.erase(it);
+        }
+    }
+    return -1;
+}
+
+void upstream_pool::checkin(int socket, std::string const& ip, size_t port) {
+    dropped.clear();
+
+    key k(ip, port);
+    auto& host = connections[k];
+    if (idle_count >= MAX_IDLE || host.size() >= MAX_IDLE_PER_HOST || !is_alive(socket)) {
+        if (host.size() == 0) {
+            connections.erase(k);
+        }
+        close(socket);
+        return;
+    }
+
+    std::unique_ptr<idle> connection(new idle());
+    connection->socket = socket;
+    connection->since = clock::now();
+    idle* current = connection.get();
+    connection->read = event_registration{queue, socket, FILTER_READ, [this, k, current](queue_event& event) {
+        drop(k, current);
+    }, true};
+
+    host.push_back(std::move(connection));
+    idle_count++;
+
+    if (!timer_active) {
+        timer.resume_listen();
+        timer_active = true;
+    }
+}
+
+void upstream_pool::drop(key const& k, idle* connection) {
+    auto it = connections.find(k);
+    if (it == connections.end()) {
+        return;
+    }
+
+    auto& host = it->second;
+    for (auto current = host.begin(); current != host.end(); ++current) {
+        if (current->get() != connection) {
+            continue;
+        }
+        connection->read.invalidate();
+        close(connection->socket);
+        dropped.push_back(std::move(*current));
+        host.erase(current);
+        idle_count--;
+        break;
+    }
+
+    if (host.size() == 0) {
+        connections.erase(it);
+    }
+}
+
+void upstream_pool::on_timer() {
+    dropped.clear();
+
+    clock::time_point now = clock::now();
+    for (auto it = connections.begin(); it != connections.end(); ) {
+        auto& host = it->second;
+        // oldest first
+        while (host.size() != 0 && now - host.front()->since >= IDLE_TIMEOUT) {
+            host.front()->read.invalidate();
+            close(host.front()->socket);
+            host.pop_front();
+            idle_count--;
+        }
+
+        if (host.size() == 0) {
+            it = connections.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    if (idle_count == 0 && timer_active) {
+        timer.stop_listen();
+        timer_active = false;
+    }
+}
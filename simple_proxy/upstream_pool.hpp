@@ -0,0 +1,79 @@
+//
+//  upstream_pool.hpp
+//  simple_proxy
+//
+
+#ifndef upstream_pool_hpp
+#define upstream_pool_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <memory>
+#include <chrono>
+
+#include "event_queue.hpp"
+#include "event_registration.h"
+
+/*
+ idle keep-alive connections to servers, keyed by (ip, port).
+ While connection is idle it's watched for reading:
+ server closing it (or sending anything unexpected) drops it from the pool.
+ Pool belongs to one event_queue, as registrations of idle sockets do
+ */
+struct upstream_pool {
+    upstream_pool(event_queue* queue);
+    ~upstream_pool();
+
+    upstream_pool(upstream_pool const&) = delete;
+    upstream_pool& operator=(upstream_pool const&) = delete;
+
+    /*
+     returns live idle connection to one of addresses (ip is set to it's address)
+     or -1 if there is no such one. Caller owns returned socket
+     */
+    int checkout(std::vector<std::string> const& addresses, size_t port, std::string& ip);
+
+    // takes ownership of socket, it's closed if pool is full
+    void checkin(int socket, std::string const& ip, size_t port);
+
+    size_t reused() const {
+        return reused_count;
+    }
+private:
+    using clock = std::chrono::steady_clock;
+    using key = std::pair<std::string, size_t>;
+
+    static const size_t MAX_IDLE_PER_HOST;
+    static const size_t MAX_IDLE;
+    static const std::chrono::seconds IDLE_TIMEOUT;
+    static const int SWEEP_PERIOD; // milliseconds
+
+    struct idle {
+        int socket;
+        clock::time_point since;
+        event_registration read;
+    };
+
+    event_queue* queue;
+
+    // most recently returned last
+    std::map<key, std::list<std::unique_ptr<idle>>> connections;
+    size_t idle_count = 0;
+    size_t reused_count = 0;
+
+    // removed connections, destroyed out of their own handlers
+    std::vector<std::unique_ptr<idle>> dropped;
+
+    event_registration timer;
+    bool timer_active = false;
+
+    static bool is_alive(int socket);
+
+    void drop(key const& k, idle* connection);
+    void on_timer();
+};
+
+#endif /* upstream_pool_hpp */